@@ -0,0 +1,75 @@
+#pragma once
+
+#include "font_store.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <optional>
+#include <string>
+
+
+// Cases run over range(0) = script, range(1) = text length in characters and range(2) = font size.
+// Fonts come from RENDERER_BENCH_FONT_<SCRIPT>, falling back to RENDERER_BENCH_FONT, a case
+// without a font is skipped.
+
+struct Script {
+    const char* name;
+    // Cycled until the text has the requested number of characters
+    const char* sample;
+};
+
+inline constexpr Script SCRIPTS[] = {
+    {"LATIN", "Typography"},
+    {"CYRILLIC", "Типография"},
+    {"GREEK", "Τυπογραφία"},
+    {"ARABIC", "الطباعةالعربية"},
+    {"DEVANAGARI", "मुद्रणकलाहिन्दी"},
+};
+inline constexpr int SCRIPT_COUNT = sizeof(SCRIPTS) / sizeof(SCRIPTS[0]);
+
+
+inline std::optional<FontId> bench_font(const int script) {
+    const std::string var = std::string("RENDERER_BENCH_FONT_") + SCRIPTS[script].name;
+    const char* path = std::getenv(var.c_str());
+    if (!path)
+        path = std::getenv("RENDERER_BENCH_FONT");
+    if (!path)
+        return std::nullopt;
+    return FontStore::shared().add(path);
+}
+
+// Whole UTF-8 code points of the script sample, repeated up to length of them
+inline std::string bench_text(const int script, const int length) {
+    const std::string sample = SCRIPTS[script].sample;
+    std::string text;
+    size_t i = 0;
+    for (int n = 0; n < length; ++n) {
+        const size_t start = i;
+        do {
+            i++;
+        } while (i < sample.size() && (static_cast<unsigned char>(sample[i]) & 0xC0) == 0x80);
+        text.append(sample, start, i - start);
+        if (i >= sample.size())
+            i = 0;
+    }
+    return text;
+}
+
+inline void set_label(benchmark::State& state) {
+    state.SetLabel(SCRIPTS[state.range(0)].name);
+}
+
+inline void script_args(benchmark::internal::Benchmark* b) {
+    for (int script = 0; script < SCRIPT_COUNT; ++script)
+        for (const int length : {4, 32})
+            for (const int size : {16, 64})
+                b->Args({script, length, size});
+}
+
+// Outlines are in design units, size does not apply
+inline void outline_args(benchmark::internal::Benchmark* b) {
+    for (int script = 0; script < SCRIPT_COUNT; ++script)
+        for (const int length : {4, 32})
+            b->Args({script, length});
+}
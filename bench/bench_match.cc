@@ -0,0 +1,118 @@
+#include "match.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <random>
+
+
+namespace {
+
+// fill_cluster_mask search as it was before match_template
+MatchOffset match_reference(const ImageTensor& templ, const ImageTensor& image, const int window_start, const int window_end) {
+    const int th = templ.dimension(0);
+    const int tw = templ.dimension(1);
+    const int fh = image.dimension(0);
+    const int fw = image.dimension(1);
+    const int start_x = std::max(0, window_start - tw + 1);
+    const int end_x = std::min(fw - tw, window_end - 1);
+    const int end_y = fh - th;
+
+    float min_loss = std::numeric_limits<float>::infinity();
+    MatchOffset best{0, 0};
+    for (int y = 0; y <= end_y; ++y) {
+        for (int x = start_x; x <= end_x; ++x) {
+            const int tx_start = std::max(0, window_start - x);
+            const int tx_end = std::min(tw, window_end - x);
+            float sqdiff = 0.0f;
+            for (int ty = 0; ty < th; ++ty) {
+                for (int tx = tx_start; tx < tx_end; ++tx) {
+                    if (templ(ty, tx) != 0) {
+                        const float diff = templ(ty, tx) - image(y + ty, x + tx);
+                        sqdiff += diff * diff;
+                    }
+                }
+            }
+            if (sqdiff < min_loss) {
+                min_loss = sqdiff;
+                best = {y, x};
+            }
+        }
+    }
+    return best;
+}
+
+
+// Text-like line: dark strokes on a white background at roughly `size` px per glyph, and a
+// cluster template cut out of it with a little rendering noise
+struct MatchCase {
+    ImageTensor image;
+    ImageTensor templ;
+    int window_start;
+    int window_end;
+
+    MatchCase(const int size, const int glyphs) {
+        std::mt19937 rng(size * 131 + glyphs);
+        const int h = size * 3 / 2;
+        const int w = size * glyphs * 3 / 5 + size;
+        image = ImageTensor(h, w);
+        image.setConstant(0);
+        for (int g = 0; g < glyphs; ++g) {
+            const int x0 = size / 2 + g * size * 3 / 5;
+            const int strokes = 2 + rng() % 3;
+            for (int s = 0; s < strokes; ++s) {
+                const int sx = x0 + rng() % std::max(1, size / 2);
+                const int sy = size / 4 + rng() % std::max(1, size / 2);
+                const int sw = 1 + size / 10 + rng() % std::max(1, size / 3);
+                const int sh = 1 + size / 10 + rng() % std::max(1, size / 2);
+                for (int y = sy; y < std::min(h, sy + sh); ++y)
+                    for (int x = sx; x < std::min(w, sx + sw); ++x)
+                        image(y, x) = static_cast<uint8_t>(160 + rng() % 96);
+            }
+        }
+
+        const int cluster = glyphs / 2;
+        const int tx = size / 2 + cluster * size * 3 / 5;
+        const int tw = std::min(w - tx, size);
+        const int ty = size / 8;
+        const int th = std::min(h - ty, size * 5 / 4);
+        templ = ImageTensor(th, tw);
+        for (int y = 0; y < th; ++y)
+            for (int x = 0; x < tw; ++x) {
+                const int v = image(ty + y, tx + x);
+                templ(y, x) = static_cast<uint8_t>(v == 0 ? 0 : std::clamp(v + static_cast<int>(rng() % 9) - 4, 1, 255));
+            }
+        window_start = std::max(0, tx - size);
+        window_end = w;
+    }
+};
+
+
+void check(benchmark::State& state, const MatchCase& c) {
+    const MatchOffset a = match_template(c.templ, c.image, c.window_start, c.window_end);
+    const MatchOffset b = match_reference(c.templ, c.image, c.window_start, c.window_end);
+    if (a.y != b.y || a.x != b.x)
+        state.SkipWithError("match_template disagrees with the reference search");
+}
+
+
+void BM_MatchReference(benchmark::State& state) {
+    const MatchCase c(state.range(0), state.range(1));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(match_reference(c.templ, c.image, c.window_start, c.window_end));
+}
+
+void BM_MatchTemplate(benchmark::State& state) {
+    const MatchCase c(state.range(0), state.range(1));
+    check(state, c);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(match_template(c.templ, c.image, c.window_start, c.window_end));
+}
+
+}
+
+
+BENCHMARK(BM_MatchReference)->ArgsProduct({{16, 32, 64}, {4, 12}})->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_MatchTemplate)->ArgsProduct({{16, 32, 64, 128}, {4, 12, 24}})->Unit(benchmark::kMicrosecond);
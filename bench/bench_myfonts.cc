@@ -0,0 +1,257 @@
+#include "bench_common.h"
+#include "cluster_mask.h"
+#include "freetype.h"
+#include "render.h"
+#include "response_cache.h"
+#include "shaper.h"
+
+#include <stb_image.h>
+#include <stb_image_write.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <tuple>
+#include <vector>
+
+
+// The MyFonts stages after a response arrived, run on PNG fixtures. A case reads
+// $RENDERER_BENCH_FIXTURES/<SCRIPT>-<length>-<size>/ when that is set:
+//   full.png                    the whole text
+//   unspaced-<i>.png            cluster i and i + 1 without spacing, cluster i alone for the last one
+//   spaced-<i>.png              the same pair with spacing, missing for the last cluster
+//   windows.txt                 "x end" of every cluster window, one per line
+// Otherwise stand-ins in the same layout are rendered with Freetype from the bench font.
+//
+// BM_MyFontsReplay runs whole renders offline against a response cache directory recorded
+// with set_response_cache, given by RENDERER_BENCH_MYFONTS_CACHE and RENDERER_BENCH_MYFONTS_ID.
+// Requests missing from it still go to the endpoint.
+
+namespace {
+
+struct Fixture {
+    std::string full;
+    std::vector<std::string> unspaced;
+    std::vector<std::string> spaced;
+    std::vector<ClusterWindow> windows;
+};
+
+
+constexpr int MARGIN = 8;
+
+// Grayscale PNG of channel 0 at (MARGIN, MARGIN) on a white page extra pixels wider than needed
+std::string encode(const ImageData& img, const int extra, const std::vector<std::pair<int, int>>& shifts = {}) {
+    const int h = static_cast<int>(img.dimension(1)) + 2 * MARGIN;
+    const int w = static_cast<int>(img.dimension(2)) + 2 * MARGIN + extra;
+    std::vector<uint8_t> page(static_cast<size_t>(h) * w, 255);
+    for (int y = 0; y < img.dimension(1); ++y) {
+        for (int x = 0; x < img.dimension(2); ++x) {
+            // Spaced pairs move the pixels of each listed mask channel right
+            int shift = 0;
+            for (const auto& [channel, by] : shifts) {
+                if (channel < img.dimension(0) && img(channel, y, x))
+                    shift = by;
+            }
+            uint8_t& px = page[static_cast<size_t>(y + MARGIN) * w + x + MARGIN + shift];
+            px = std::min(px, img(0, y, x));
+        }
+    }
+    std::string png;
+    const auto append = [](void* context, void* data, const int size) {
+        static_cast<std::string*>(context)->append(static_cast<const char*>(data), size);
+    };
+    if (!stbi_write_png_to_func(append, &png, w, h, 1, page.data(), w))
+        throw std::runtime_error("Could not encode fixture");
+    return png;
+}
+
+Fixture synthesize(const FontId font, const std::string& text, const unsigned size) {
+    Shaper shaper;
+    shaper.set_font(font);
+    shaper.set_params({96, true});
+    shaper.set_text(text);
+    shaper.shape(size);
+
+    Fixture f;
+    f.windows = shaper.get_cluster_windows();
+    const std::vector<std::string> strings = shaper.cluster_strings();
+    unsigned max_width;
+    shaper.text_size(&max_width);
+    const int spacing = static_cast<int>(max_width * 1.5f);
+    f.full = encode(Freetype::render_text(shaper), 0);
+
+    Shaper pair;
+    pair.set_font(font);
+    pair.set_params({96, true});
+    for (size_t i = 0; i < strings.size(); ++i) {
+        const bool last = i + 1 == strings.size();
+        pair.set_text(last ? strings[i] : strings[i] + strings[i + 1]);
+        pair.shape(size);
+        const ImageData img = Freetype::render_text(pair);
+        f.unspaced.push_back(encode(img, spacing));
+        f.spaced.push_back(last ? std::string() : encode(img, spacing, {{IMAGE_DIM + 1, spacing}}));
+    }
+    return f;
+}
+
+std::string read_file(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("Could not open fixture " + path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+Fixture load(const std::string& dir) {
+    Fixture f;
+    f.full = read_file(dir + "/full.png");
+    std::ifstream windows(dir + "/windows.txt");
+    ClusterWindow w;
+    while (windows >> w.x >> w.end)
+        f.windows.push_back(w);
+    for (size_t i = 0; i < f.windows.size(); ++i) {
+        f.unspaced.push_back(read_file(dir + "/unspaced-" + std::to_string(i) + ".png"));
+        f.spaced.push_back(i + 1 < f.windows.size() ? read_file(dir + "/spaced-" + std::to_string(i) + ".png") : std::string());
+    }
+    return f;
+}
+
+// Built once per case, benchmark calls a case several times while sizing its run
+const Fixture* fixture(benchmark::State& state) {
+    set_label(state);
+    const int script = static_cast<int>(state.range(0));
+    const int length = static_cast<int>(state.range(1));
+    const auto size = static_cast<unsigned>(state.range(2));
+
+    static std::map<std::tuple<int, int, unsigned>, Fixture> fixtures;
+    const auto key = std::tuple(script, length, size);
+    if (const auto it = fixtures.find(key); it != fixtures.end())
+        return &it->second;
+
+    try {
+        if (const char* dir = std::getenv("RENDERER_BENCH_FIXTURES")) {
+            return &fixtures.emplace(key, load(std::string(dir) + "/" + SCRIPTS[script].name + "-" + std::to_string(length) + "-" + std::to_string(size))).first->second;
+        }
+        const auto font = bench_font(script);
+        if (!font) {
+            state.SkipWithError("no fixtures or font, set RENDERER_BENCH_FIXTURES or RENDERER_BENCH_FONT");
+            return nullptr;
+        }
+        return &fixtures.emplace(key, synthesize(*font, bench_text(script, length), size)).first->second;
+    } catch (const std::exception& e) {
+        state.SkipWithError(e.what());
+        return nullptr;
+    }
+}
+
+OwnedImage decode(const std::string& png) {
+    int width, height, comp;
+    unsigned char* data = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(png.data()), static_cast<int>(png.size()), &width, &height, &comp, 1);
+    if (!data)
+        throw std::runtime_error("Could not decode fixture");
+    return {data, height, width};
+}
+
+
+void BM_DecodeResponses(benchmark::State& state) {
+    const Fixture* f = fixture(state);
+    if (!f)
+        return;
+    size_t bytes = f->full.size();
+    for (size_t i = 0; i < f->unspaced.size(); ++i)
+        bytes += f->unspaced[i].size() + f->spaced[i].size();
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(decode(f->full).dims());
+        for (size_t i = 0; i < f->unspaced.size(); ++i) {
+            benchmark::DoNotOptimize(decode(f->unspaced[i]).dims());
+            if (!f->spaced[i].empty())
+                benchmark::DoNotOptimize(decode(f->spaced[i]).dims());
+        }
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * bytes));
+}
+
+void BM_Nonzero(benchmark::State& state) {
+    const Fixture* f = fixture(state);
+    if (!f)
+        return;
+    OwnedImage full = decode(f->full);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(nonzero(full.view(), full.dims(), false));
+}
+
+// Everything fill_cluster_mask used to do: cut each cluster out of its pair, find it in the
+// full image and mark its pixels
+void BM_ClusterMask(benchmark::State& state) {
+    const Fixture* f = fixture(state);
+    if (!f)
+        return;
+
+    OwnedImage full = decode(f->full);
+    const auto nz = nonzero(full.view(), full.dims(), false);
+    ImageTensor target = full.view().slice(nz.first, nz.second);
+    invert_inplace(target);
+
+    std::vector<OwnedImage> unspaced;
+    std::vector<std::optional<OwnedImage>> spaced;
+    for (size_t i = 0; i < f->unspaced.size(); ++i) {
+        invert_inplace(unspaced.emplace_back(decode(f->unspaced[i])).view());
+        spaced.emplace_back();
+        if (!f->spaced[i].empty())
+            invert_inplace(spaced.back().emplace(decode(f->spaced[i])).view());
+    }
+
+    const auto clusters = static_cast<Eigen::Index>(unspaced.size());
+    ChannelCanvas canvas(clusters, target.dimension(0), target.dimension(1));
+    for (auto _ : state) {
+        for (size_t i = 0; i < unspaced.size(); ++i) {
+            const ImageTensor templ = cluster_template(unspaced[i], spaced[i] ? &*spaced[i] : nullptr);
+            const int window_end = spaced[i] ? f->windows[i].end : static_cast<int>(target.dimension(1));
+            const MatchOffset offset = match_template(templ, target, f->windows[i].x, window_end);
+            mark_cluster(canvas, static_cast<unsigned>(i), templ, offset);
+        }
+        benchmark::ClobberMemory();
+    }
+    state.counters["clusters"] = static_cast<double>(clusters);
+}
+
+void BM_MyFontsReplay(benchmark::State& state) {
+    set_label(state);
+    const char* cache = std::getenv("RENDERER_BENCH_MYFONTS_CACHE");
+    const char* myfonts_id = std::getenv("RENDERER_BENCH_MYFONTS_ID");
+    const auto font = bench_font(static_cast<int>(state.range(0)));
+    if (!cache || !myfonts_id || !font) {
+        state.SkipWithError("set RENDERER_BENCH_MYFONTS_CACHE, RENDERER_BENCH_MYFONTS_ID and RENDERER_BENCH_FONT");
+        return;
+    }
+    ResponseCache::shared().configure(cache, size_t{1} << 40);
+
+    Renderer r;
+    r.set_font_id(*font);
+    r.set_mode(RenderMode::MYFONTS, myfonts_id);
+    r.set_text(bench_text(static_cast<int>(state.range(0)), static_cast<int>(state.range(1))));
+    const auto size = static_cast<unsigned>(state.range(2));
+    try {
+        r.render_text(size);
+    } catch (const std::exception& e) {
+        state.SkipWithError(e.what());
+        return;
+    }
+
+    ResponseCache::shared().reset_stats();
+    for (auto _ : state)
+        benchmark::DoNotOptimize(r.render_text(size).data());
+    state.counters["cache_misses"] = static_cast<double>(ResponseCache::shared().stats().misses);
+}
+
+}
+
+
+BENCHMARK(BM_DecodeResponses)->Apply(script_args);
+BENCHMARK(BM_Nonzero)->Apply(script_args);
+BENCHMARK(BM_ClusterMask)->Apply(script_args);
+BENCHMARK(BM_MyFontsReplay)->Apply(script_args)->UseRealTime();
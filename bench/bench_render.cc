@@ -0,0 +1,320 @@
+#include "bench_common.h"
+#include "blit.h"
+#include "freetype.h"
+#include "glyph_cache.h"
+#include "outline_atlas.h"
+#include "raster.h"
+#include "shape_cache.h"
+#include "shaper.h"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+
+namespace {
+
+// Caches are left warm by default. The *Cold variants set their budgets to zero so that every
+// call does the full work, and put back whatever budgets were in effect before.
+struct CacheBudget {
+    explicit CacheBudget(const bool cold)
+        : cold(cold), shape_budget(shape_cache().stats().budget), glyph_budget(glyph_cache().stats().budget) {
+        if (cold) {
+            shape_cache().set_budget(0);
+            glyph_cache().set_budget(0);
+        }
+    }
+    ~CacheBudget() {
+        if (cold) {
+            shape_cache().set_budget(shape_budget);
+            glyph_cache().set_budget(glyph_budget);
+        }
+    }
+    bool cold;
+    size_t shape_budget;
+    size_t glyph_budget;
+};
+
+bool setup(benchmark::State& state, Shaper& shaper) {
+    set_label(state);
+    const auto font = bench_font(static_cast<int>(state.range(0)));
+    if (!font) {
+        state.SkipWithError("no font, set RENDERER_BENCH_FONT");
+        return false;
+    }
+    shaper.set_font(*font);
+    shaper.set_params({72, false});
+    shaper.set_text(bench_text(static_cast<int>(state.range(0)), static_cast<int>(state.range(1))));
+    return true;
+}
+
+
+template<bool Cold>
+void BM_Shape(benchmark::State& state) {
+    Shaper shaper;
+    if (!setup(state, shaper))
+        return;
+    const CacheBudget budget(Cold);
+    const auto size = static_cast<unsigned>(state.range(2));
+    for (auto _ : state) {
+        shaper.shape(size);
+        benchmark::DoNotOptimize(shaper.get_glyph_count());
+    }
+}
+
+template<bool Cold>
+void BM_ShapeDesign(benchmark::State& state) {
+    Shaper shaper;
+    if (!setup(state, shaper))
+        return;
+    const CacheBudget budget(Cold);
+    for (auto _ : state) {
+        shaper.shape_design();
+        benchmark::DoNotOptimize(shaper.get_glyph_count());
+    }
+}
+
+template<bool Cold>
+void BM_TextSize(benchmark::State& state) {
+    Shaper shaper;
+    if (!setup(state, shaper))
+        return;
+    const CacheBudget budget(Cold);
+    shaper.shape(static_cast<unsigned>(state.range(2)));
+    unsigned max_width;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(shaper.text_size(&max_width));
+}
+
+template<bool Cold>
+void BM_FreetypeRender(benchmark::State& state) {
+    Shaper shaper;
+    if (!setup(state, shaper))
+        return;
+    const CacheBudget budget(Cold);
+    shaper.shape(static_cast<unsigned>(state.range(2)));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(Freetype::render_text(shaper));
+}
+
+// A word at the scale augmentation sizes of render_text_sizes, sizes stay on their own FT_Size
+// and keep the cluster segmentation of the previous size
+template<bool Cold>
+void BM_FreetypeRenderSizes(benchmark::State& state) {
+    Shaper shaper;
+    if (!setup(state, shaper))
+        return;
+    const CacheBudget budget(Cold);
+    for (auto _ : state) {
+        for (const unsigned size : {12u, 16u, 24u, 32u, 48u, 64u}) {
+            shaper.shape(size);
+            benchmark::DoNotOptimize(Freetype::render_text(shaper));
+        }
+    }
+}
+
+// Sweeps the first variation axis over 16 instances at one size, to compare with
+// BM_FreetypeRenderSizes. Cold starts every instance from scratch.
+template<bool Cold>
+void BM_FreetypeRenderVariations(benchmark::State& state) {
+    Shaper shaper;
+    if (!setup(state, shaper))
+        return;
+    const std::vector<VariationAxis> axes = shaper.variation_axes();
+    if (axes.empty()) {
+        state.SkipWithError("font is not variable");
+        return;
+    }
+    const CacheBudget budget(Cold);
+    const VariationAxis& axis = axes.front();
+    const auto size = static_cast<unsigned>(state.range(2));
+    for (auto _ : state) {
+        for (int i = 0; i < 16; ++i) {
+            shaper.set_variations({{axis.tag, axis.min + (axis.max - axis.min) * static_cast<float>(i) / 15.0f}});
+            shaper.shape(size);
+            benchmark::DoNotOptimize(Freetype::render_text(shaper));
+        }
+    }
+}
+
+// One glyph sized block of rows composited by each kernel, width pixels per row, with the
+// transparent edges and antialiased ramps of a real bitmap
+void BM_Blit(benchmark::State& state) {
+    const auto kernel = static_cast<BlitKernel>(state.range(0));
+    const auto width = static_cast<size_t>(state.range(1));
+    state.SetLabel(blit_kernel_name(kernel));
+    const BlitRow row = blit_kernel(kernel);
+    if (!row) {
+        state.SkipWithError("kernel not supported on this CPU");
+        return;
+    }
+    constexpr size_t ROWS = 64;
+    std::vector<uint8_t> alpha(ROWS * width);
+    for (size_t y = 0; y < ROWS; ++y)
+        for (size_t x = 0; x < width; ++x)
+            alpha[y * width + x] = static_cast<uint8_t>((x + y) % 7 == 0 ? 0 : std::min<size_t>(255, (x * 37 + y * 11) % 320));
+    std::vector<uint8_t> image(ROWS * width, 255);
+    std::vector<uint8_t> mask(ROWS * width, 0);
+    for (auto _ : state) {
+        for (size_t y = 0; y < ROWS; ++y)
+            row(image.data() + y * width, mask.data() + y * width, alpha.data() + y * width, width);
+        benchmark::DoNotOptimize(image.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * ROWS * width));
+}
+
+// Same text and size as BM_FreetypeRender, rotated by 15 degrees and filled by the rasterizer
+void BM_Rasterize(benchmark::State& state) {
+    Shaper shaper;
+    if (!setup(state, shaper))
+        return;
+    shaper.shape_design();
+    TextPaths text;
+    shaper.path_data(text.first, text.second);
+    const float scale = static_cast<float>(state.range(2)) / static_cast<float>(shaper.get_ft_face()->units_per_EM);
+    const float c = std::cos(0.26f) * scale;
+    const float s = std::sin(0.26f) * scale;
+    const Matrix3 rotate = {c, -s, 0, s, c, 0, 0, 0, 1};
+    for (auto _ : state)
+        benchmark::DoNotOptimize(Rasterizer::render_text(text, rotate));
+}
+
+// Attaches an atlas of the shaper's font for the duration of a case, built in the temp directory
+struct AtlasAttached {
+    explicit AtlasAttached(const FontId font) : font(font) {
+        OutlineStore::shared().attach_dir(font, (std::filesystem::temp_directory_path() / "renderer_bench_atlas").string());
+    }
+    ~AtlasAttached() {
+        OutlineStore::shared().detach(font);
+    }
+    FontId font;
+};
+
+template<bool Atlas>
+void BM_PathData(benchmark::State& state) {
+    Shaper shaper;
+    if (!setup(state, shaper))
+        return;
+    std::optional<AtlasAttached> atlas;
+    if (Atlas)
+        atlas.emplace(shaper.get_font_id());
+    shaper.shape_design();
+    std::vector<Path> paths;
+    std::vector<float> advances;
+    for (auto _ : state) {
+        paths.clear();
+        advances.clear();
+        shaper.path_data(paths, advances);
+        benchmark::DoNotOptimize(paths.data());
+    }
+}
+
+
+// Outlines of the case text for the Path cases
+bool text_paths(benchmark::State& state, std::vector<Path>& paths) {
+    Shaper shaper;
+    if (!setup(state, shaper))
+        return false;
+    shaper.shape_design();
+    std::vector<float> advances;
+    shaper.path_data(paths, advances);
+    return true;
+}
+
+void BM_PathAsRel(benchmark::State& state) {
+    std::vector<Path> paths;
+    if (!text_paths(state, paths))
+        return;
+    for (auto _ : state)
+        for (const auto& path : paths)
+            benchmark::DoNotOptimize(path.as_rel());
+}
+
+void BM_PathToCubic(benchmark::State& state) {
+    std::vector<Path> paths;
+    if (!text_paths(state, paths))
+        return;
+    for (auto _ : state) {
+        std::vector<Path> copy = paths;
+        for (auto& path : copy)
+            benchmark::DoNotOptimize(path.to_cubic());
+    }
+}
+
+void BM_PathReorder(benchmark::State& state) {
+    std::vector<Path> paths;
+    if (!text_paths(state, paths))
+        return;
+    // Assigning into the same copy reuses its buffers, so only the reorder itself is timed
+    std::vector<Path> copy = paths;
+    for (auto _ : state) {
+        copy = paths;
+        reorder_paths(copy);
+        benchmark::DoNotOptimize(copy.data());
+    }
+}
+
+// Same affine map as a matrix and as the per point callback Python used to go through
+constexpr Matrix3 SKEW = {0.9f, 0.2f, 12, 0, 1.1f, -30, 0, 0, 1};
+
+void BM_PathTransform(benchmark::State& state) {
+    std::vector<Path> paths;
+    if (!text_paths(state, paths))
+        return;
+    for (auto _ : state) {
+        transform_paths(paths, SKEW);
+        benchmark::DoNotOptimize(paths.data());
+    }
+}
+
+void BM_PathTransformCallback(benchmark::State& state) {
+    std::vector<Path> paths;
+    if (!text_paths(state, paths))
+        return;
+    const std::function<std::pair<float, float>(float, float)> skew = [](const float x, const float y) {
+        return std::pair{SKEW[0] * x + SKEW[1] * y + SKEW[2], SKEW[3] * x + SKEW[4] * y + SKEW[5]};
+    };
+    for (auto _ : state) {
+        for (auto& path : paths)
+            path.transform(skew);
+        benchmark::DoNotOptimize(paths.data());
+    }
+}
+
+void BM_PathString(benchmark::State& state) {
+    std::vector<Path> paths;
+    if (!text_paths(state, paths))
+        return;
+    for (auto _ : state)
+        for (const auto& path : paths)
+            benchmark::DoNotOptimize(path.string());
+}
+
+}
+
+
+BENCHMARK(BM_Shape<false>)->Name("BM_Shape")->Apply(script_args);
+BENCHMARK(BM_Shape<true>)->Name("BM_ShapeCold")->Apply(script_args);
+BENCHMARK(BM_ShapeDesign<false>)->Name("BM_ShapeDesign")->Apply(outline_args);
+BENCHMARK(BM_ShapeDesign<true>)->Name("BM_ShapeDesignCold")->Apply(outline_args);
+BENCHMARK(BM_TextSize<false>)->Name("BM_TextSize")->Apply(script_args);
+BENCHMARK(BM_TextSize<true>)->Name("BM_TextSizeCold")->Apply(script_args);
+BENCHMARK(BM_FreetypeRender<false>)->Name("BM_FreetypeRender")->Apply(script_args);
+BENCHMARK(BM_FreetypeRender<true>)->Name("BM_FreetypeRenderCold")->Apply(script_args);
+BENCHMARK(BM_FreetypeRenderSizes<false>)->Name("BM_FreetypeRenderSizes")->Apply(outline_args);
+BENCHMARK(BM_FreetypeRenderSizes<true>)->Name("BM_FreetypeRenderSizesCold")->Apply(outline_args);
+BENCHMARK(BM_FreetypeRenderVariations<false>)->Name("BM_FreetypeRenderVariations")->Apply(script_args);
+BENCHMARK(BM_FreetypeRenderVariations<true>)->Name("BM_FreetypeRenderVariationsCold")->Apply(script_args);
+BENCHMARK(BM_Blit)->ArgsProduct({{0, 1, 2, 3}, {8, 24, 64, 256}});
+BENCHMARK(BM_Rasterize)->Apply(script_args);
+BENCHMARK(BM_PathData<false>)->Name("BM_PathData")->Apply(outline_args);
+BENCHMARK(BM_PathData<true>)->Name("BM_PathDataAtlas")->Apply(outline_args);
+BENCHMARK(BM_PathAsRel)->Apply(outline_args);
+BENCHMARK(BM_PathToCubic)->Apply(outline_args);
+BENCHMARK(BM_PathReorder)->Apply(outline_args);
+BENCHMARK(BM_PathTransform)->Apply(outline_args);
+BENCHMARK(BM_PathTransformCallback)->Apply(outline_args);
+BENCHMARK(BM_PathString)->Apply(outline_args);
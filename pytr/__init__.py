@@ -12,5 +12,19 @@
 
 from .path import *
 from .renderer_ext import *
+from renderer import glyph_cache_stats, reset_glyph_cache_stats, set_glyph_cache_budget, clear_glyph_cache
+from renderer import shape_cache_stats, reset_shape_cache_stats, set_shape_cache_budget, clear_shape_cache
+from renderer import set_response_cache, response_cache_stats, reset_response_cache_stats, clear_response_cache
+from renderer import DatasetWriter, DatasetReader
+from renderer import build_outline_atlas, attach_outline_atlas, attach_outline_atlas_dir, detach_outline_atlas
+from renderer import transform_paths, reorder_paths, pack_paths
+from renderer import set_myfonts_endpoint, configure_myfonts_requests, myfonts_request_stats, reset_myfonts_request_stats
 
-__all__ = ['Renderer', 'Path']
\ No newline at end of file
+__all__ = [
+    'Renderer', 'Path', 'register_font', 'DatasetWriter', 'DatasetReader', 'transform_paths', 'reorder_paths', 'pack_paths',
+    'glyph_cache_stats', 'reset_glyph_cache_stats', 'set_glyph_cache_budget', 'clear_glyph_cache',
+    'shape_cache_stats', 'reset_shape_cache_stats', 'set_shape_cache_budget', 'clear_shape_cache',
+    'set_response_cache', 'response_cache_stats', 'reset_response_cache_stats', 'clear_response_cache',
+    'build_outline_atlas', 'attach_outline_atlas', 'attach_outline_atlas_dir', 'detach_outline_atlas',
+    'set_myfonts_endpoint', 'configure_myfonts_requests', 'myfonts_request_stats', 'reset_myfonts_request_stats',
+]
\ No newline at end of file
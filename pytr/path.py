@@ -1,14 +1,17 @@
 from typing import Callable, Tuple
+from numpy.typing import ArrayLike
 import renderer
 
 class Path(renderer.Path):
-    def string(self) -> str:
-        return super().string()
+    def string(self, precision: int | None = None) -> str:
+        """SVG path data, numbers rounded to precision decimals when given"""
+        return super().string(precision)
     
     def as_rel(self) -> 'Path':
         return super().as_rel()
     
-    def transform(self, tr: Callable[[float, float], Tuple[float, float]]) -> 'Path':
+    def transform(self, tr: Callable[[float, float], Tuple[float, float]] | ArrayLike) -> 'Path':
+        """tr maps one point at a time, or is a 3x3 matrix applied to (x, y, 1) natively"""
         return super().transform(tr)
 
     def to_cubic(self) -> 'Path':
@@ -7,10 +7,11 @@ from typing import Literal
 from numpy.typing import NDArray
 from uuid import uuid4
 import os
+import asyncio
 import tempfile
 
 import requests
-from .utils import make_preview_url, trim_img
+from .utils import make_preview_url, trim_img, trim_labels, channels_to_labels, write_into
 from itertools import zip_longest
 from fontTools import ttLib
 import cv2
@@ -61,6 +62,21 @@ BASE_HTML = """
 """
 
 
+_font_ids: dict[str, int] = {}
+
+
+def register_font(font_path: str) -> int:
+    """Map a font file once per process and return its id for Renderer.set_font_id"""
+    if font_path in _font_ids:
+        return _font_ids[font_path]
+    ftf = ttLib.TTFont(font_path)
+    if 'COLR' in ftf or 'SVG ' in ftf or 'CBDT' in ftf or 'sbix' in ftf:
+        raise ValueError("Color fonts are not supported")
+    font_id = renderer.register_font(os.path.abspath(font_path).replace('\\', '/'))
+    _font_ids[font_path] = font_id
+    return font_id
+
+
 class Renderer(renderer.Renderer):
     def __init__(self):
         super().__init__()
@@ -98,16 +114,32 @@ class Renderer(renderer.Renderer):
 
 
     def set_font(self, font_path: str):
-        ftf = ttLib.TTFont(font_path)
-        if 'COLR' in ftf or 'SVG ' in ftf or 'CBDT' in ftf or 'sbix' in ftf:
-            raise ValueError("Color fonts are not supported")
-        self._font_path = os.path.abspath(font_path).replace('\\', '/')
-        super().set_font(self._font_path)
+        self.set_font_id(register_font(font_path))
+
+    def set_font_id(self, font_id: int):
+        self._font_path = renderer.font_path(font_id)
+        super().set_font_id(font_id)
+
+    def variation_axes(self) -> list[dict]:
+        """Variation axes of the current font as dicts of tag, min, default and max, empty unless it is variable"""
+        return super().variation_axes()
+
+    def set_variations(self, values: dict[str, float]):
+        """Move the current font to the instance at values by axis tag, e.g. {"wght": 650, "wdth": 85}
+
+            Axes left out take their default, values are clamped to the axis range. The face isn't
+            reloaded and shaping and glyphs are cached per instance, so sweeping an axis costs about
+            as much as changing the size. Applies to "freetype", text_paths and render_transformed.
+            set_font with another font starts at its default instance. render_batch and
+            render_batch_to always render the default instance of each font.
+        """
+        super().set_variations(values)
 
     def set_text(self, text: str):
         if ' ' in text:
             raise ValueError("Spaces are not supported in text")
         super().set_text(text)
+        self._text = text
 
     def set_mode(self, mode: Literal['freetype', 'chromium', 'firefox', 'myfonts'], myfonts_id: str | None = None):
 
@@ -130,23 +162,143 @@ class Renderer(renderer.Renderer):
         """Get design text outlines and advances. len(paths) - 1 == len(advances)"""
         return super().text_paths()
 
+    def text_path_arrays(self) -> dict[str, np.ndarray]:
+        """text_paths packed into flat arrays without per command Python objects.
+        verbs (V,) uint8: M=0 m=1 L=2 l=3 Q=4 q=5 C=6 c=7 Z=8, points (N, 2) float32,
+        contours (C, 2) uint32 first verb and point of each contour,
+        paths (P + 1, 3) uint32 first verb, point and contour of each path plus an end row, advances (P - 1,) float32"""
+        return super().text_path_arrays()
+
     def render_text(
                 self, 
                 size: int, 
-            ) -> NDArray[np.uint8]:
+                masks: Literal['channels', 'labels'] = 'channels',
+                out: NDArray[np.uint8] | None = None,
+            ) -> NDArray[np.uint8] | tuple[NDArray[np.uint8], NDArray[np.uint16], NDArray[np.int32]]:
         """Render text with size and mode
             
             Image and masks as (I, H, W). I = 0 is image, I > 0 are cluster masks.
+
+            masks="labels" returns (image (H, W), labels (H, W), overlaps (N, 3)) instead.
+            labels holds 0 for background and k for cluster k - 1, overlaps lists (y, x, label)
+            for pixels also covered by a cluster other than the one in labels.
+
+            out is an optional preallocated uint8 (C, H, W) buffer with contiguous rows. The sample
+            is written into its leading corner, everything else is reset to background, and the
+            written view out[:I, :H, :W] is returned.
         """
 
-        if self._mode == 'freetype':
-            imgs = super().render_text(size)
-        elif self._mode == 'myfonts':
-            return super().render_text(size)
+        if masks not in ['channels', 'labels']:
+            raise ValueError(f"Masks \"{masks}\" doesn't exist")
+
+        if masks == 'labels':
+            if out is not None:
+                raise ValueError("out is only supported for masks=\"channels\"")
+            if self._mode in ['freetype', 'myfonts']:
+                return super().render_labels(size)
+            elif self._mode in ['chromium', 'firefox']:
+                imgs = self._web_render_text(size, self._mode)
+                return trim_labels(*channels_to_labels(imgs), white_bg=True)
+
+        if self._mode in ['freetype', 'myfonts']:
+            return super().render_text(size, out)
         elif self._mode in ['chromium', 'firefox']:
-            imgs = self._web_render_text(size, self._mode)
+            imgs = trim_img(self._web_render_text(size, self._mode), white_bg=True)
+            return imgs if out is None else write_into(imgs, out)
+
+    def render_text_sizes(self, sizes: list[int]) -> list[NDArray[np.uint8]]:
+        """render_text(size) for every size in one call, same output layout per size
+
+            "freetype" and "myfonts" share the shaping work across sizes, and "myfonts" sends the
+            requests of all sizes together.
+        """
+
+        if self._mode in ['freetype', 'myfonts']:
+            return super().render_text_sizes(sizes)
+        return [self.render_text(size) for size in sizes]
+
+    def render_text_async(self, size: int) -> 'asyncio.Future[NDArray[np.uint8]]':
+        """render_text(size) as an awaitable of the running event loop
+
+            In "myfonts" mode this returns once the requests are sent and the future completes from
+            the C++ side when the image is ready, so many words can be in flight from one loop.
+            The renderer can take the next text right away. "freetype" renders before returning.
+        """
+
+        if self._mode not in ['freetype', 'myfonts']:
+            raise ValueError(f"Mode \"{self._mode}\" doesn't support async rendering")
+        return super().render_text_async(size)
+
+    def render_transformed(
+                self,
+                size: int,
+                matrix: NDArray[np.float32],
+                masks: Literal['channels', 'labels'] = 'channels',
+            ) -> NDArray[np.uint8] | tuple[NDArray[np.uint8], NDArray[np.uint16], NDArray[np.int32]]:
+        """Render text at size through a (3, 3) matrix with the native rasterizer, in any mode
+
+            matrix maps pixel coordinates with y down as column vectors, so rotations, shears
+            and perspective are applied to the outlines before they are filled. Translation
+            doesn't matter, the result is cropped to the ink. Same output layouts as render_text.
+        """
+
+        if masks == 'channels':
+            return super().render_transformed(size, matrix)
+        if masks == 'labels':
+            return super().render_transformed_labels(size, matrix)
+        raise ValueError(f"Masks \"{masks}\" doesn't exist")
+
+
+    def render_batch(
+                self,
+                texts: list[str],
+                sizes: list[int],
+                fonts: list[str],
+            ) -> list[NDArray[np.uint8]]:
+        """Render texts[i] at sizes[i] with fonts[i] on all cores, without holding the GIL
+
+            Only "freetype" and "myfonts" modes. Same output layout as render_text. Variations
+            are ignored, every font renders at its default instance.
+        """
+
+        if self._mode not in ['freetype', 'myfonts']:
+            raise ValueError(f"Mode \"{self._mode}\" doesn't support batch rendering")
+        if any(' ' in text for text in texts):
+            raise ValueError("Spaces are not supported in text")
+
+        font_paths = [renderer.font_path(register_font(font)) for font in fonts]
+        return super().render_batch(texts, sizes, font_paths)
+
+
+    def render_to(self, writer: renderer.DatasetWriter, size: int, paths: bool = True):
+        """Render text with size and mode and queue it on a DatasetWriter
+
+            Same sample as render_text(size), plus the text_paths outlines when paths is set.
+        """
+
+        if self._mode in ['freetype', 'myfonts']:
+            return super().render_to(writer, size, paths)
+        imgs = self.render_text(size)
+        outlines, advances = super().text_paths() if paths else ([], [])
+        writer.write(imgs, self._text, self._font_path, size, self._mode, outlines, advances)
+
+    def render_batch_to(
+                self,
+                writer: renderer.DatasetWriter,
+                texts: list[str],
+                sizes: list[int],
+                fonts: list[str],
+                paths: bool = True,
+            ):
+        """render_batch straight into a DatasetWriter, samples land in completion order"""
+
+        if self._mode not in ['freetype', 'myfonts']:
+            raise ValueError(f"Mode \"{self._mode}\" doesn't support batch rendering")
+        if any(' ' in text for text in texts):
+            raise ValueError("Spaces are not supported in text")
 
-        return trim_img(imgs, white_bg=True)
+        font_paths = [renderer.font_path(register_font(font)) for font in fonts]
+        return super().render_batch_to(writer, texts, sizes, font_paths, paths)
 
 
     def _web_render_text(self, size, mode):
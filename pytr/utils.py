@@ -16,3 +16,35 @@ def trim_img(img, white_bg=False):
         nz = np.where(img[0] != bg)
     return img[..., np.min(nz[0]):np.max(nz[0]) + 1, np.min(nz[1]):np.max(nz[1]) + 1]
 
+
+
+def write_into(imgs, out):
+    """Copy (I, H, W) imgs into the leading corner of out, the rest of out is reset to background"""
+    c, h, w = imgs.shape
+    if out.shape[0] < c or out.shape[1] < h or out.shape[2] < w:
+        raise ValueError(f"Output buffer too small, need ({c}, {h}, {w})")
+    out[0] = 255
+    out[1:] = 0
+    out[:c, :h, :w] = imgs
+    return out[:c, :h, :w]
+
+
+def trim_labels(img, labels, overlaps, white_bg=False):
+    bg = 255 if white_bg else 0
+    nz = np.where(img != bg)
+    y0, x0 = np.min(nz[0]), np.min(nz[1])
+    y1, x1 = np.max(nz[0]) + 1, np.max(nz[1]) + 1
+    overlaps = overlaps - np.array([y0, x0, 0], dtype=overlaps.dtype)
+    return img[y0:y1, x0:x1], labels[y0:y1, x0:x1], overlaps
+
+
+def channels_to_labels(imgs):
+    """(I, H, W) image and masks to the layout of render_text(masks='labels')"""
+    masks = imgs[1:] != 0
+    covered = masks.any(axis=0)
+    labels = np.where(covered, masks.argmax(axis=0) + 1, 0).astype(np.uint16)
+    cs, ys, xs = np.nonzero(masks)
+    extra = cs + 1 != labels[ys, xs]
+    overlaps = np.stack([ys[extra], xs[extra], cs[extra] + 1], axis=1).astype(np.int32)
+    order = np.lexsort((overlaps[:, 2], overlaps[:, 1], overlaps[:, 0]))
+    return imgs[0], labels, overlaps[order]
@@ -1,23 +1,239 @@
 
 #include <pybind11/pybind11.h>
 #include <pybind11/eigen/tensor.h>
+#include <pybind11/numpy.h>
 #include <pybind11/stl.h>
 #include <fmt/format.h>
+#include <chrono>
+#include <exception>
+#include <memory>
 #include <optional>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "render.h"
 #include "path.h"
+#include "glyph_cache.h"
+#include "shape_cache.h"
+#include "response_cache.h"
+#include "request_scheduler.h"
+#include "dataset.h"
+#include "outline_atlas.h"
+#include "stats.h"
 
 namespace py = pybind11;
 using namespace pybind11::literals;
 
 
+py::dict part_dict(const PartStats& s) {
+    return py::dict(
+        "count"_a = s.count,
+        "errors"_a = s.errors,
+        "mean_ms"_a = s.mean_ms,
+        "max_ms"_a = s.max_ms
+    );
+}
+
+py::dict stats_dict(const CacheStats& s) {
+    return py::dict(
+        "hits"_a = s.hits,
+        "misses"_a = s.misses,
+        "evictions"_a = s.evictions,
+        "entries"_a = s.entries,
+        "bytes"_a = s.bytes,
+        "budget"_a = s.budget
+    );
+}
+
+py::dict render_stats_dict(const RenderStats& s) {
+    py::dict stages;
+    for (size_t i = 0; i < STAGE_COUNT; ++i) {
+        const StageStats& st = s.stages[i];
+        stages[Stats::name(static_cast<Stage>(i))] = py::dict(
+            "count"_a = st.count,
+            "total_ms"_a = st.total_ms,
+            "mean_ms"_a = st.mean_ms,
+            "max_ms"_a = st.max_ms,
+            "p50_ms"_a = st.p50_ms,
+            "p90_ms"_a = st.p90_ms,
+            "p99_ms"_a = st.p99_ms,
+            "histogram_us"_a = std::vector<uint64_t>(st.histogram.begin(), st.histogram.end())
+        );
+    }
+    py::dict counters;
+    for (size_t i = 0; i < TALLY_COUNT; ++i)
+        counters[Stats::name(static_cast<Tally>(i))] = s.tallies[i];
+    return py::dict("enabled"_a = Stats::enabled(), "stages"_a = stages, "counters"_a = counters);
+}
+
+
+// Hands the tensor's buffer to numpy without copying, the capsule owns the tensor
+template<typename Tensor>
+py::array to_numpy(Tensor tensor) {
+    using Scalar = typename Tensor::Scalar;
+    constexpr int rank = Tensor::NumDimensions;
+    auto* owned = new Tensor(std::move(tensor));
+    py::capsule base(owned, [](void* p) { delete static_cast<Tensor*>(p); });
+
+    std::vector<py::ssize_t> shape(rank);
+    std::vector<py::ssize_t> strides(rank);
+    py::ssize_t stride = sizeof(Scalar);
+    for (int i = rank - 1; i >= 0; --i) {
+        shape[i] = owned->dimension(i);
+        strides[i] = stride;
+        stride *= shape[i];
+    }
+    return py::array_t<Scalar>(shape, strides, owned->data(), base);
+}
+
+// Gives a vector's buffer to numpy as a C ordered array of Scalar, the capsule owns the vector
+template<typename Scalar, typename T>
+py::array vector_to_numpy(std::vector<T> v, std::vector<py::ssize_t> shape) {
+    static_assert(sizeof(T) % sizeof(Scalar) == 0);
+    auto* owned = new std::vector<T>(std::move(v));
+    py::capsule base(owned, [](void* p) { delete static_cast<std::vector<T>*>(p); });
+    return py::array_t<Scalar>(shape, reinterpret_cast<const Scalar*>(owned->data()), base);
+}
+
+py::dict path_arrays_dict(PathArrays a, std::vector<float> advances) {
+    const auto verbs = static_cast<py::ssize_t>(a.verbs.size());
+    const auto points = static_cast<py::ssize_t>(a.points.size());
+    const auto contours = static_cast<py::ssize_t>(a.contours.size());
+    const auto paths = static_cast<py::ssize_t>(a.paths.size());
+    const auto advance_count = static_cast<py::ssize_t>(advances.size());
+    return py::dict(
+        "verbs"_a = vector_to_numpy<uint8_t>(std::move(a.verbs), {verbs}),
+        "points"_a = vector_to_numpy<float>(std::move(a.points), {points, 2}),
+        "contours"_a = vector_to_numpy<uint32_t>(std::move(a.contours), {contours, 2}),
+        "paths"_a = vector_to_numpy<uint32_t>(std::move(a.paths), {paths, 3}),
+        "advances"_a = vector_to_numpy<float>(std::move(advances), {advance_count})
+    );
+}
+
+
+using MatrixArray = py::array_t<float, py::array::c_style | py::array::forcecast>;
+
+Matrix3 matrix_at(const MatrixArray& a, const py::ssize_t i) {
+    Matrix3 m;
+    std::copy_n(a.data() + i * 9, 9, m.begin());
+    return m;
+}
+
+Matrix3 to_matrix(const MatrixArray& a) {
+    if (a.ndim() != 2 || a.shape(0) != 3 || a.shape(1) != 3)
+        throw py::value_error("matrix must have shape (3, 3)");
+    return matrix_at(a, 0);
+}
+
+ImageView image_view(py::array& out) {
+    if (!out.dtype().is(py::dtype::of<uint8_t>()))
+        throw py::type_error("out must be a uint8 array");
+    if (out.ndim() != 3)
+        throw py::value_error("out must have shape (C, H, W)");
+    if (!out.writeable())
+        throw py::value_error("out must be writeable");
+    if (out.shape(2) > 1 && out.strides(2) != 1)
+        throw py::value_error("out rows must be contiguous");
+    return {
+        static_cast<uint8_t*>(out.mutable_data()),
+        out.shape(0), out.shape(1), out.shape(2),
+        out.strides(0), out.strides(1)
+    };
+}
+
+// (image, labels, overlaps) with one (y, x, label) row per overlapping pixel
+py::tuple label_tuple(LabelData data) {
+    py::array_t<int32_t> overlaps({static_cast<py::ssize_t>(data.overlaps.size()), py::ssize_t{3}});
+    auto o = overlaps.mutable_unchecked<2>();
+    for (size_t i = 0; i < data.overlaps.size(); i++) {
+        o(i, 0) = data.overlaps[i].y;
+        o(i, 1) = data.overlaps[i].x;
+        o(i, 2) = data.overlaps[i].label;
+    }
+    return py::make_tuple(to_numpy(std::move(data.image)), to_numpy(std::move(data.labels)), overlaps);
+}
+
+
+// The Python exception pybind11 would raise for error, through all registered translators
+py::object exception_object(std::exception_ptr error) {
+    try {
+        py::cpp_function([error] { std::rethrow_exception(error); })();
+    } catch (py::error_already_set& e) {
+        return e.value();
+    }
+    return py::none();
+}
+
+// One render_text_async call. The render finishes on a scheduler or pool thread, which only
+// stores the outcome and holds the GIL for the one call that queues resolve on the loop. The
+// result is converted and the Python references are dropped on the loop's thread.
+struct AsyncResult {
+    py::object loop;
+    py::object future;
+    ImageData image;
+    std::exception_ptr error;
+
+    AsyncResult(py::object loop, py::object future) : loop(std::move(loop)), future(std::move(future)) {}
+
+    // Still set only when the interpreter was gone before resolve could run, leaked then
+    ~AsyncResult() {
+        loop.release();
+        future.release();
+    }
+
+    // On the loop's thread, the future may have been cancelled meanwhile
+    void resolve() {
+        const py::object target = std::move(future);
+        loop = py::object();
+        if (target.attr("done")().cast<bool>())
+            return;
+        if (error)
+            target.attr("set_exception")(exception_object(error));
+        else
+            target.attr("set_result")(to_numpy(std::move(image)));
+    }
+
+    static void settle(const std::shared_ptr<AsyncResult>& self, ImageData img, std::exception_ptr error) {
+        self->image = std::move(img);
+        self->error = error;
+        if (!Py_IsInitialized())
+            return;
+
+        py::gil_scoped_acquire gil;
+        // Created once and kept for the life of the process
+        static const py::handle resolve_owner = py::cpp_function([](const py::capsule& owner) {
+            (*owner.get_pointer<std::shared_ptr<AsyncResult>>())->resolve();
+        }).release();
+        try {
+            py::capsule owner(new std::shared_ptr<AsyncResult>(self), [](void* p) {
+                delete static_cast<std::shared_ptr<AsyncResult>*>(p);
+            });
+            self->loop.attr("call_soon_threadsafe")(resolve_owner, owner);
+        } catch (py::error_already_set& e) {
+            // Most likely the loop was closed, nobody is left to receive the result
+            e.discard_as_unraisable("render_text_async");
+            self->future = py::object();
+            self->loop = py::object();
+        }
+    }
+};
+
+
 PYBIND11_MODULE(renderer, m) {
 
     py::class_<Renderer>(m, "Renderer")
         .def(py::init<>())
         .def("set_font", &Renderer::set_font)
+        .def("set_font_id", &Renderer::set_font_id, "font_id"_a)
+        .def("set_warm_fonts", &Renderer::set_warm_fonts, "capacity"_a)
+        .def("set_variations", &Renderer::set_variations, "values"_a)
+        .def("variation_axes", [](const Renderer& r) {
+            py::list axes;
+            for (const VariationAxis& axis : r.variation_axes())
+                axes.append(py::dict("tag"_a = axis.tag, "min"_a = axis.min, "default"_a = axis.def, "max"_a = axis.max));
+            return axes;
+        })
         .def("set_text", &Renderer::set_text)
         .def("set_mode", [](Renderer& r, const std::string& mode, std::optional<std::string> myfonts_id) {
             RenderMode m;
@@ -31,19 +247,193 @@ PYBIND11_MODULE(renderer, m) {
             return r.set_mode(m, std::move(myfonts_id));
         }, "mode"_a, "myfonts_id"_a = py::none())
         .def("text_paths", &Renderer::text_paths)
-        .def("render_text", &Renderer::render_text, "font_size"_a)
+        .def("text_path_arrays", [](Renderer& r) {
+            TextPaths paths;
+            PathArrays arrays;
+            {
+                py::gil_scoped_release release;
+                paths = r.text_paths();
+                arrays = pack_paths(paths.first);
+            }
+            return path_arrays_dict(std::move(arrays), std::move(paths.second));
+        })
+        .def("render_text", [](Renderer& r, const unsigned font_size, std::optional<py::array> out) -> py::object {
+            if (!out) {
+                ImageData img;
+                {
+                    py::gil_scoped_release release;
+                    img = r.render_text(font_size);
+                }
+                return to_numpy(std::move(img));
+            }
+
+            const ImageView view = image_view(*out);
+            ImageDims dims;
+            {
+                py::gil_scoped_release release;
+                dims = r.render_into(font_size, view);
+            }
+            return (*out)[py::make_tuple(py::slice(0, dims[0], 1), py::slice(0, dims[1], 1), py::slice(0, dims[2], 1))];
+        }, "font_size"_a, "out"_a = py::none())
+        .def("render_text_sizes", [](Renderer& r, const std::vector<unsigned>& font_sizes) {
+            std::vector<ImageData> images;
+            {
+                py::gil_scoped_release release;
+                images = r.render_text_sizes(font_sizes);
+            }
+            py::list out;
+            for (auto& img : images)
+                out.append(to_numpy(std::move(img)));
+            return out;
+        }, "font_sizes"_a)
+        .def("render_text_async", [](Renderer& r, const unsigned font_size) {
+            py::object loop = py::module_::import("asyncio").attr("get_running_loop")();
+            py::object future = loop.attr("create_future")();
+            auto result = std::make_shared<AsyncResult>(loop, future);
+            {
+                py::gil_scoped_release release;
+                r.render_text_async(font_size, [result](ImageData img, std::exception_ptr error) {
+                    AsyncResult::settle(result, std::move(img), error);
+                });
+            }
+            return future;
+        }, "font_size"_a)
+        .def("render_labels", [](Renderer& r, const unsigned font_size) {
+            LabelData data;
+            {
+                py::gil_scoped_release release;
+                data = r.render_labels(font_size);
+            }
+            return label_tuple(std::move(data));
+        }, "font_size"_a)
+        .def("render_transformed", [](Renderer& r, const unsigned font_size, const MatrixArray& matrix) {
+            const Matrix3 m = to_matrix(matrix);
+            ImageData img;
+            {
+                py::gil_scoped_release release;
+                img = r.render_transformed(font_size, m);
+            }
+            return to_numpy(std::move(img));
+        }, "font_size"_a, "matrix"_a)
+        .def("render_transformed_labels", [](Renderer& r, const unsigned font_size, const MatrixArray& matrix) {
+            const Matrix3 m = to_matrix(matrix);
+            LabelData data;
+            {
+                py::gil_scoped_release release;
+                data = r.render_transformed_labels(font_size, m);
+            }
+            return label_tuple(std::move(data));
+        }, "font_size"_a, "matrix"_a)
+        .def("render_batch", [](Renderer& r, const std::vector<std::string>& texts, const std::vector<unsigned>& sizes, const std::vector<std::string>& fonts) {
+            std::vector<ImageData> imgs;
+            {
+                py::gil_scoped_release release;
+                imgs = r.render_batch(texts, sizes, fonts);
+            }
+            py::list out;
+            for (auto& img : imgs)
+                out.append(to_numpy(std::move(img)));
+            return out;
+        }, "texts"_a, "sizes"_a, "fonts"_a)
+        .def("render_to", [](Renderer& r, DatasetWriter& writer, const unsigned font_size, const bool paths) {
+            py::gil_scoped_release release;
+            r.render_to(writer, font_size, paths);
+        }, "writer"_a, "font_size"_a, "paths"_a = true)
+        .def("render_batch_to", [](Renderer& r, DatasetWriter& writer, const std::vector<std::string>& texts, const std::vector<unsigned>& sizes, const std::vector<std::string>& fonts, const bool paths) {
+            py::gil_scoped_release release;
+            r.render_batch_to(writer, texts, sizes, fonts, paths);
+        }, "writer"_a, "texts"_a, "sizes"_a, "fonts"_a, "paths"_a = true)
         .def("shape_if_needed", &Renderer::shape_if_needed)
-        .def("cluster_strings", &Renderer::cluster_strings);
+        .def("cluster_strings", &Renderer::cluster_strings)
+        // Process wide, every Renderer and pool thread records into the same stats
+        .def_static("enable_stats", [](const bool enabled, const bool trace) {
+            Stats::enable(enabled);
+            Stats::enable_trace(enabled && trace);
+        }, "enabled"_a = true, "trace"_a = false)
+        .def_static("stats", [] { return render_stats_dict(Stats::snapshot()); })
+        .def_static("reset_stats", &Stats::reset)
+        .def_static("write_trace", [](const std::string& path) {
+            py::gil_scoped_release release;
+            Stats::write_trace(path);
+        }, "path"_a);
         
 
 
     py::class_<Path>(m, "Path")
-        .def("string", &Path::string)
+        .def("string", [](const Path& p, const std::optional<int> precision) { return p.string(precision.value_or(-1)); }, "precision"_a = py::none())
         .def("as_rel", &Path::as_rel)
         .def("to_cubic", &Path::to_cubic)
-        .def("transform", &Path::transform)
+        .def("transform", py::overload_cast<const std::function<std::pair<float, float>(float, float)>&>(&Path::transform))
+        .def("transform", [](Path& p, const MatrixArray& matrix) -> Path& {
+            const Matrix3 m = to_matrix(matrix);
+            py::gil_scoped_release release;
+            return p.transform(m);
+        }, "matrix"_a)
         .def("reorder", &Path::reorder)
-        .def_property_readonly("first_x", [](const Path& p) { return p.get_commands().front().to.x; });
+        .def_property_readonly("first_x", [](const Path& p) {
+            if (p.empty() || point_count(p.verbs().front()) == 0)
+                throw py::value_error("path does not start with a point");
+            return p.points()[point_count(p.verbs().front()) - 1].x;
+        });
+
+
+    py::class_<DatasetWriter>(m, "DatasetWriter")
+        .def(py::init<std::string, size_t, size_t>(), "prefix"_a, "shard_bytes"_a = size_t{1} << 30, "queue_bytes"_a = size_t{256} << 20)
+        .def("write", [](
+                DatasetWriter& w,
+                const py::array_t<uint8_t, py::array::c_style | py::array::forcecast>& image,
+                const std::string& text,
+                const std::string& font,
+                const unsigned size,
+                const std::string& mode,
+                std::vector<Path> paths,
+                std::vector<float> advances
+            ) {
+            if (image.ndim() != 3)
+                throw py::value_error("image must have shape (C, H, W)");
+            Sample sample;
+            sample.image = ImageData(image.shape(0), image.shape(1), image.shape(2));
+            std::copy_n(image.data(), image.size(), sample.image.data());
+            sample.paths = std::move(paths);
+            sample.advances = std::move(advances);
+            sample.text = text;
+            sample.font = font;
+            sample.mode = mode;
+            sample.size = size;
+            py::gil_scoped_release release;
+            w.write(sample);
+        }, "image"_a, "text"_a, "font"_a, "size"_a, "mode"_a, "paths"_a = std::vector<Path>{}, "advances"_a = std::vector<float>{})
+        .def("close", [](DatasetWriter& w) {
+            py::gil_scoped_release release;
+            w.close();
+        })
+        .def_property_readonly("records", &DatasetWriter::records)
+        .def_property_readonly("shards", &DatasetWriter::shards)
+        .def("__enter__", [](DatasetWriter& w) -> DatasetWriter& { return w; }, py::return_value_policy::reference)
+        .def("__exit__", [](DatasetWriter& w, const py::args&) {
+            py::gil_scoped_release release;
+            w.close();
+        });
+
+    py::class_<DatasetReader>(m, "DatasetReader")
+        .def(py::init<const std::string&>(), "path"_a)
+        .def("__len__", &DatasetReader::size)
+        .def("__getitem__", [](const DatasetReader& r, const size_t i) {
+            Sample s;
+            {
+                py::gil_scoped_release release;
+                s = r.read(i);
+            }
+            return py::dict(
+                "image"_a = to_numpy(std::move(s.image)),
+                "text"_a = s.text,
+                "font"_a = s.font,
+                "size"_a = s.size,
+                "mode"_a = s.mode,
+                "paths"_a = std::move(s.paths),
+                "advances"_a = std::move(s.advances)
+            );
+        }, "i"_a);
 
 
     py::class_<ClusterWindow>(m, "ClusterWindow")
@@ -51,4 +441,103 @@ PYBIND11_MODULE(renderer, m) {
         .def_readwrite("x", &ClusterWindow::x)
         .def_readwrite("end", &ClusterWindow::end);
 
+
+    m.def("pack_paths", [](const std::vector<const Path*>& paths) {
+        PathArrays arrays;
+        {
+            py::gil_scoped_release release;
+            arrays = pack_paths(paths);
+        }
+        return path_arrays_dict(std::move(arrays), {});
+    }, "paths"_a);
+
+    m.def("transform_paths", [](const std::vector<Path*>& paths, const MatrixArray& matrices) {
+        if (matrices.ndim() == 2) {
+            const Matrix3 m = to_matrix(matrices);
+            py::gil_scoped_release release;
+            for (Path* p : paths)
+                p->transform(m);
+            return;
+        }
+        if (matrices.ndim() != 3 || matrices.shape(0) != static_cast<py::ssize_t>(paths.size()) || matrices.shape(1) != 3 || matrices.shape(2) != 3)
+            throw py::value_error("matrices must have shape (3, 3) or (len(paths), 3, 3)");
+        py::gil_scoped_release release;
+        for (size_t i = 0; i < paths.size(); ++i)
+            paths[i]->transform(matrix_at(matrices, static_cast<py::ssize_t>(i)));
+    }, "paths"_a, "matrices"_a);
+
+    m.def("reorder_paths", [](const std::vector<Path*>& paths) {
+        py::gil_scoped_release release;
+        for (Path* p : paths)
+            p->reorder();
+    }, "paths"_a);
+
+    m.def("register_font", [](const std::string& path) { return FontStore::shared().add(path); }, "path"_a);
+    m.def("font_path", [](const FontId id) { return FontStore::shared().path(id); }, "font_id"_a);
+
+    m.def("build_outline_atlas", [](const std::string& font_path, const std::string& atlas_path) {
+        const FontId font = FontStore::shared().add(font_path);
+        py::gil_scoped_release release;
+        OutlineAtlas::build(font, atlas_path);
+    }, "font_path"_a, "atlas_path"_a);
+    m.def("attach_outline_atlas", [](const std::string& font_path, const std::string& atlas_path) {
+        OutlineStore::shared().attach(FontStore::shared().add(font_path), atlas_path);
+    }, "font_path"_a, "atlas_path"_a);
+    m.def("attach_outline_atlas_dir", [](const std::string& font_path, const std::string& directory) {
+        const FontId font = FontStore::shared().add(font_path);
+        py::gil_scoped_release release;
+        OutlineStore::shared().attach_dir(font, directory);
+    }, "font_path"_a, "directory"_a);
+    m.def("detach_outline_atlas", [](const std::string& font_path) {
+        OutlineStore::shared().detach(FontStore::shared().add(font_path));
+    }, "font_path"_a);
+
+    m.def("glyph_cache_stats", [] { return stats_dict(glyph_cache().stats()); });
+    m.def("reset_glyph_cache_stats", [] { glyph_cache().reset_stats(); });
+    m.def("set_glyph_cache_budget", [](const size_t bytes) { glyph_cache().set_budget(bytes); }, "bytes"_a);
+    m.def("clear_glyph_cache", [] { glyph_cache().clear(); });
+
+    m.def("shape_cache_stats", [] { return stats_dict(shape_cache().stats()); });
+    m.def("reset_shape_cache_stats", [] { shape_cache().reset_stats(); });
+    m.def("set_shape_cache_budget", [](const size_t bytes) { shape_cache().set_budget(bytes); }, "bytes"_a);
+    m.def("clear_shape_cache", [] { shape_cache().clear(); });
+
+    m.def("set_response_cache", [](const std::string& directory, const size_t budget) {
+        ResponseCache::shared().configure(directory, budget);
+    }, "directory"_a, "budget"_a = size_t{1} << 30);
+    m.def("response_cache_stats", [] { return stats_dict(ResponseCache::shared().stats()); });
+    m.def("reset_response_cache_stats", [] { ResponseCache::shared().reset_stats(); });
+    m.def("clear_response_cache", [] { ResponseCache::shared().clear(); });
+    m.def("set_myfonts_endpoint", &MyFonts::set_endpoint, "url"_a);
+
+    m.def("configure_myfonts_requests", [](
+            const unsigned max_in_flight,
+            const unsigned max_retries,
+            const unsigned backoff_ms,
+            const unsigned max_backoff_ms,
+            const unsigned hedge_after_ms,
+            const unsigned timeout_ms
+        ) {
+        py::gil_scoped_release release;
+        RequestScheduler::shared().configure({
+            max_in_flight, max_retries,
+            std::chrono::milliseconds(backoff_ms), std::chrono::milliseconds(max_backoff_ms),
+            std::chrono::milliseconds(hedge_after_ms), std::chrono::milliseconds(timeout_ms)
+        });
+    }, "max_in_flight"_a = 8, "max_retries"_a = 3, "backoff_ms"_a = 100, "max_backoff_ms"_a = 5000,
+       "hedge_after_ms"_a = 0, "timeout_ms"_a = 30000);
+    m.def("myfonts_request_stats", [] {
+        const SchedulerStats s = RequestScheduler::shared().stats();
+        return py::dict(
+            "requests"_a = part_dict(s.requests),
+            "queue"_a = part_dict(s.queue),
+            "http"_a = part_dict(s.http),
+            "retries"_a = part_dict(s.retries),
+            "hedges"_a = part_dict(s.hedges),
+            "hedge_wins"_a = s.hedge_wins,
+            "in_flight"_a = s.in_flight
+        );
+    });
+    m.def("reset_myfonts_request_stats", [] { RequestScheduler::shared().reset_stats(); });
+
 }
\ No newline at end of file
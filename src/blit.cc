@@ -0,0 +1,223 @@
+#include "blit.h"
+
+#include <cstring>
+#include <initializer_list>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define BLIT_SSE2
+#if defined(__GNUC__) || defined(_MSC_VER)
+#include <immintrin.h>
+#define BLIT_AVX2
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define BLIT_NEON
+#endif
+
+// GCC and Clang only emit AVX2 in functions that ask for it, MSVC always can
+#if defined(BLIT_AVX2) && defined(__GNUC__)
+#define BLIT_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define BLIT_TARGET_AVX2
+#endif
+
+
+namespace {
+
+inline int div255(const int v) {
+    return ((v >> 8) + v) >> 8;
+}
+
+// The per pixel loop the SIMD kernels replaced, kept as the reference and the fallback
+template<bool Mark>
+void blit_scalar(uint8_t* image, uint8_t* mask, const uint8_t* alpha, const size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        const int a = alpha[i];
+        if (a == 0)
+            continue;
+        if constexpr (Mark)
+            mask[i] = 1;
+        image[i] = static_cast<uint8_t>(div255(image[i] * (255 - a) + 128));
+    }
+}
+
+// Tail of the SIMD kernels, without the branch on alpha they don't have either
+template<bool Mark>
+void blit_tail(uint8_t* image, uint8_t* mask, const uint8_t* alpha, const size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        const int a = alpha[i];
+        if constexpr (Mark)
+            mask[i] |= a != 0;
+        image[i] = static_cast<uint8_t>(div255(image[i] * (255 - a) + 128));
+    }
+}
+
+
+#if defined(BLIT_SSE2)
+
+// v * (255 - a) / 255 on 16 bit lanes, t + (t >> 8) can't overflow for t <= 255 * 255 + 128
+inline __m128i blend_sse2(const __m128i v, const __m128i a) {
+    const __m128i t = _mm_add_epi16(_mm_mullo_epi16(v, _mm_sub_epi16(_mm_set1_epi16(255), a)), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+template<bool Mark>
+inline void blit16_sse2(uint8_t* image, uint8_t* mask, const uint8_t* alpha) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(alpha));
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(image));
+    const __m128i lo = blend_sse2(_mm_unpacklo_epi8(v, zero), _mm_unpacklo_epi8(a, zero));
+    const __m128i hi = blend_sse2(_mm_unpackhi_epi8(v, zero), _mm_unpackhi_epi8(a, zero));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(image), _mm_packus_epi16(lo, hi));
+    if constexpr (Mark) {
+        const __m128i covered = _mm_andnot_si128(_mm_cmpeq_epi8(a, zero), _mm_set1_epi8(1));
+        const __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(mask), _mm_or_si128(m, covered));
+    }
+}
+
+template<bool Mark>
+void blit_sse2(uint8_t* image, uint8_t* mask, const uint8_t* alpha, const size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+        blit16_sse2<Mark>(image + i, Mark ? mask + i : nullptr, alpha + i);
+    blit_tail<Mark>(image + i, Mark ? mask + i : nullptr, alpha + i, n - i);
+}
+
+#endif
+
+
+#if defined(BLIT_AVX2)
+
+BLIT_TARGET_AVX2 inline __m256i blend_avx2(const __m256i v, const __m256i a) {
+    const __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(v, _mm256_sub_epi16(_mm256_set1_epi16(255), a)), _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+// Unpacking and packing both work within 128 bit lanes, so bytes come back in order
+template<bool Mark>
+BLIT_TARGET_AVX2 void blit_avx2(uint8_t* image, uint8_t* mask, const uint8_t* alpha, const size_t n) {
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(alpha + i));
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(image + i));
+        const __m256i lo = blend_avx2(_mm256_unpacklo_epi8(v, zero), _mm256_unpacklo_epi8(a, zero));
+        const __m256i hi = blend_avx2(_mm256_unpackhi_epi8(v, zero), _mm256_unpackhi_epi8(a, zero));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(image + i), _mm256_packus_epi16(lo, hi));
+        if constexpr (Mark) {
+            const __m256i covered = _mm256_andnot_si256(_mm256_cmpeq_epi8(a, zero), _mm256_set1_epi8(1));
+            const __m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mask + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(mask + i), _mm256_or_si256(m, covered));
+        }
+    }
+    if (i < n)
+        blit_sse2<Mark>(image + i, Mark ? mask + i : nullptr, alpha + i, n - i);
+}
+
+bool cpu_has_avx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    // OSXSAVE and AVX, then whether the OS saves the ymm registers
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+
+#if defined(BLIT_NEON)
+
+template<bool Mark>
+inline void blit16_neon(uint8_t* image, uint8_t* mask, const uint8_t* alpha) {
+    const uint8x16_t a = vld1q_u8(alpha);
+    const uint8x16_t v = vld1q_u8(image);
+    const uint8x16_t inverse = vmvnq_u8(a);
+    const uint16x8_t round = vdupq_n_u16(128);
+    const uint16x8_t lo = vaddq_u16(vmull_u8(vget_low_u8(v), vget_low_u8(inverse)), round);
+    const uint16x8_t hi = vaddq_u16(vmull_u8(vget_high_u8(v), vget_high_u8(inverse)), round);
+    vst1q_u8(image, vcombine_u8(vshrn_n_u16(vsraq_n_u16(lo, lo, 8), 8), vshrn_n_u16(vsraq_n_u16(hi, hi, 8), 8)));
+    if constexpr (Mark)
+        vst1q_u8(mask, vorrq_u8(vld1q_u8(mask), vandq_u8(vtstq_u8(a, a), vdupq_n_u8(1))));
+}
+
+template<bool Mark>
+void blit_neon(uint8_t* image, uint8_t* mask, const uint8_t* alpha, const size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+        blit16_neon<Mark>(image + i, Mark ? mask + i : nullptr, alpha + i);
+    blit_tail<Mark>(image + i, Mark ? mask + i : nullptr, alpha + i, n - i);
+}
+
+#endif
+
+
+template<void (*Marked)(uint8_t*, uint8_t*, const uint8_t*, size_t), void (*Unmarked)(uint8_t*, uint8_t*, const uint8_t*, size_t)>
+void dispatch_mask(uint8_t* image, uint8_t* mask, const uint8_t* alpha, const size_t n) {
+    if (mask)
+        Marked(image, mask, alpha, n);
+    else
+        Unmarked(image, nullptr, alpha, n);
+}
+
+}
+
+
+BlitRow blit_kernel(const BlitKernel kernel) {
+    switch (kernel) {
+    case BlitKernel::SCALAR:
+        return dispatch_mask<blit_scalar<true>, blit_scalar<false>>;
+#if defined(BLIT_SSE2)
+    case BlitKernel::SSE2:
+        return dispatch_mask<blit_sse2<true>, blit_sse2<false>>;
+#endif
+#if defined(BLIT_AVX2)
+    case BlitKernel::AVX2:
+        return cpu_has_avx2() ? dispatch_mask<blit_avx2<true>, blit_avx2<false>> : nullptr;
+#endif
+#if defined(BLIT_NEON)
+    case BlitKernel::NEON:
+        return dispatch_mask<blit_neon<true>, blit_neon<false>>;
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+BlitKernel best_blit_kernel() {
+    static const BlitKernel best = [] {
+        for (const BlitKernel kernel : {BlitKernel::AVX2, BlitKernel::SSE2, BlitKernel::NEON})
+            if (blit_kernel(kernel))
+                return kernel;
+        return BlitKernel::SCALAR;
+    }();
+    return best;
+}
+
+const char* blit_kernel_name(const BlitKernel kernel) {
+    switch (kernel) {
+    case BlitKernel::SCALAR: return "scalar";
+    case BlitKernel::SSE2: return "sse2";
+    case BlitKernel::AVX2: return "avx2";
+    case BlitKernel::NEON: return "neon";
+    }
+    return "unknown";
+}
+
+void blit_row(uint8_t* image, uint8_t* mask, const uint8_t* alpha, const size_t n) {
+    static const BlitRow row = blit_kernel(best_blit_kernel());
+    row(image, mask, alpha, n);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+// Row kernels that composite glyph coverage onto the image. They all give exactly the same
+// result as the scalar one, blit_row runs the widest one the CPU supports.
+
+enum class BlitKernel { SCALAR, SSE2, AVX2, NEON };
+
+// Darkens image[0, n) by alpha, image = image * (255 - alpha) / 255 rounded, and sets mask to 1
+// wherever alpha is nonzero unless mask is null
+using BlitRow = void (*)(uint8_t* image, uint8_t* mask, const uint8_t* alpha, size_t n);
+
+// Null when this build or CPU can't run the kernel
+BlitRow blit_kernel(BlitKernel kernel);
+// Picked once, from runtime CPU detection on x86
+BlitKernel best_blit_kernel();
+const char* blit_kernel_name(BlitKernel kernel);
+
+void blit_row(uint8_t* image, uint8_t* mask, const uint8_t* alpha, size_t n);
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "blit.h"
+#include "common.h"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+
+// Destinations for the image and the per cluster masks. Renderers are templated on these so
+// the same compositing code can produce either layout.
+
+
+// Caller owned (C, H, W) buffer, rows must be contiguous
+struct ImageView {
+    uint8_t* data;
+    Eigen::Index channels;
+    Eigen::Index height;
+    Eigen::Index width;
+    Eigen::Index channel_stride;
+    Eigen::Index row_stride;
+};
+
+using ImageDims = std::array<Eigen::Index, 3>;
+
+
+// ImageData layout: channel 0 is the image, channel IMAGE_DIM + i is the 0/1 mask of cluster i
+class ChannelCanvas {
+public:
+    using Output = ImageData;
+    static constexpr bool concurrent_marks = true; // clusters own disjoint channels
+
+    // Bytes a canvas of this size allocates
+    static Eigen::Index bytes(const Eigen::Index clusters, const Eigen::Index h, const Eigen::Index w) {
+        return (IMAGE_DIM + clusters) * h * w;
+    }
+
+    ChannelCanvas(const Eigen::Index clusters, const Eigen::Index h, const Eigen::Index w)
+        : img(IMAGE_DIM + clusters, h, w), c(IMAGE_DIM + clusters), h(h), w(w) {
+        img.setZero();
+        data = img.data();
+        channel_stride = h * w;
+        row_stride = w;
+    }
+
+    // Writes into the leading (C, H, W) corner of out and resets the rest of it to background
+    ChannelCanvas(const ImageView& out, const Eigen::Index clusters, const Eigen::Index h, const Eigen::Index w)
+        : c(IMAGE_DIM + clusters), h(h), w(w) {
+        if (out.channels < c || out.height < h || out.width < w)
+            throw std::invalid_argument(
+                "Output buffer too small, need (" + std::to_string(c) + ", " + std::to_string(h) + ", " + std::to_string(w) + ")"
+            );
+        data = out.data;
+        channel_stride = out.channel_stride;
+        row_stride = out.row_stride;
+        for (Eigen::Index ch = 0; ch < out.channels; ++ch)
+            for (Eigen::Index y = 0; y < out.height; ++y)
+                std::fill_n(data + ch * channel_stride + y * row_stride, out.width, ch < IMAGE_DIM ? 255 : 0);
+    }
+
+    Eigen::Index height() const { return h; }
+    Eigen::Index width() const { return w; }
+
+    uint8_t* image_row(const Eigen::Index y) { return data + y * row_stride; }
+    uint8_t& image(const Eigen::Index y, const Eigen::Index x) { return data[y * row_stride + x]; }
+    void fill_image(const uint8_t v) {
+        for (Eigen::Index y = 0; y < h; ++y)
+            std::fill_n(image_row(y), w, v);
+    }
+
+    void mark(const unsigned cluster, const Eigen::Index y, const Eigen::Index x) {
+        data[(IMAGE_DIM + cluster) * channel_stride + y * row_stride + x] = 1;
+    }
+
+    // Composites n pixels of coverage from (y, x) on and marks the covered ones as cluster's
+    void composite_row(const unsigned cluster, const Eigen::Index y, const Eigen::Index x, const uint8_t* alpha, const Eigen::Index n) {
+        const Eigen::Index at = y * row_stride + x;
+        blit_row(data + at, data + (IMAGE_DIM + cluster) * channel_stride + at, alpha, static_cast<size_t>(n));
+    }
+
+    ImageData finish() { return std::move(img); }
+
+protected:
+    ImageData img;
+    uint8_t* data;
+    Eigen::Index c;
+    Eigen::Index h;
+    Eigen::Index w;
+    Eigen::Index channel_stride;
+    Eigen::Index row_stride;
+};
+
+
+// ChannelCanvas over an ImageView, reports how much of it was written
+class ViewCanvas : public ChannelCanvas {
+public:
+    using Output = ImageDims;
+
+    using ChannelCanvas::ChannelCanvas;
+
+    ImageDims finish() const { return {c, h, w}; }
+};
+
+
+// LabelData layout: one uint16 label per pixel plus the pixels covered by more than one cluster
+class LabelCanvas {
+public:
+    using Output = LabelData;
+    static constexpr bool concurrent_marks = false;
+
+    // Bytes a canvas of this size allocates, overlaps aside
+    static Eigen::Index bytes(Eigen::Index /*clusters*/, const Eigen::Index h, const Eigen::Index w) {
+        return h * w * static_cast<Eigen::Index>(sizeof(uint8_t) + sizeof(uint16_t));
+    }
+
+    LabelCanvas(const Eigen::Index clusters, const Eigen::Index h, const Eigen::Index w) {
+        if (clusters >= std::numeric_limits<uint16_t>::max())
+            throw std::runtime_error("Too many clusters for a uint16 label map");
+        data.image = ImageTensor(h, w);
+        data.labels = LabelTensor(h, w);
+        data.image.setZero();
+        data.labels.setZero();
+    }
+
+    Eigen::Index height() const { return data.image.dimension(0); }
+    Eigen::Index width() const { return data.image.dimension(1); }
+
+    uint8_t* image_row(const Eigen::Index y) { return data.image.data() + y * width(); }
+    uint8_t& image(const Eigen::Index y, const Eigen::Index x) { return data.image(y, x); }
+    void fill_image(const uint8_t v) { data.image.setConstant(v); }
+
+    void mark(const unsigned cluster, const Eigen::Index y, const Eigen::Index x) {
+        const auto label = static_cast<uint16_t>(cluster + 1);
+        uint16_t& current = data.labels(y, x);
+        if (current == 0)
+            current = label;
+        else if (current != label)
+            data.overlaps.push_back({static_cast<int>(y), static_cast<int>(x), label});
+    }
+
+    void composite_row(const unsigned cluster, const Eigen::Index y, const Eigen::Index x, const uint8_t* alpha, const Eigen::Index n) {
+        blit_row(image_row(y) + x, nullptr, alpha, static_cast<size_t>(n));
+        for (Eigen::Index i = 0; i < n; ++i)
+            if (alpha[i] != 0)
+                mark(cluster, y, x + i);
+    }
+
+    LabelData finish() {
+        auto& o = data.overlaps;
+        const auto key = [](const LabelOverlap& a) { return std::tuple(a.y, a.x, a.label); };
+        std::sort(o.begin(), o.end(), [&](const auto& a, const auto& b) { return key(a) < key(b); });
+        o.erase(std::unique(o.begin(), o.end(), [&](const auto& a, const auto& b) { return key(a) == key(b); }), o.end());
+        return std::move(data);
+    }
+
+private:
+    LabelData data;
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "common.h"
+#include "match.h"
+#include "owned_image.h"
+
+#include <utility>
+
+
+// Pieces of MyFonts rendering that find each cluster's pixels in the full image
+
+template<typename Tensor>
+void invert_inplace(Tensor&& img) {
+    const auto size = img.size();
+    auto* ptr = img.data();
+    for (size_t i = 0; i < size; ++i) {
+        ptr[i] = 255 - ptr[i];
+    }
+}
+
+
+template<typename Image, typename Dims>
+std::pair<Eigen::array<Eigen::Index, 2>, Eigen::array<Eigen::Index, 2>> nonzero(const Image& img, const Dims& dims, const bool wonb = true) {
+    TextBox box{};
+
+    const uint8_t bg = wonb ? 0 : 255;
+
+    for (int y = 0; y < dims[0]; ++y) {
+        for (int x = 0; x < dims[1]; ++x) {
+            if (img(y, x) != bg) {
+                box.y_min = y;
+                goto found_top;
+            }
+        }
+    }
+found_top:
+    for (int y = dims[0] - 1; y >= 0; --y) {
+        for (int x = 0; x < dims[1]; ++x) {
+            if (img(y, x) != bg) {
+                box.y_max = y;
+                goto found_bottom;
+            }
+        }
+    }
+found_bottom:
+    for (int x = 0; x < dims[1]; ++x) {
+        for (int y = 0; y < dims[0]; ++y) {
+            if (img(y, x) != bg) {
+                box.x_min = x;
+                goto found_left;
+            }
+        }
+    }
+found_left:
+    for (int x = dims[1] - 1; x >= 0; --x) {
+        for (int y = 0; y < dims[0]; ++y) {
+            if (img(y, x) != bg) {
+                box.x_max = x;
+                goto found_right;
+            }
+        }
+    }
+found_right:
+
+    Eigen::array<Eigen::Index, 2> offsets = {box.y_min, box.x_min};
+    Eigen::array<Eigen::Index, 2> extents = {box.y_max - box.y_min + 1, box.x_max - box.x_min + 1};
+    return {offsets, extents};
+}
+
+
+// Ink of one cluster cut out of its inverted request images. With a spaced image the cluster
+// is whatever comes before the first column where the spaced pair differs from the unspaced one.
+ImageTensor cluster_template(OwnedImage& unspaced, OwnedImage* spaced);
+
+
+template<typename Canvas>
+void mark_cluster(Canvas& canvas, const unsigned cluster, const ImageTensor& cluster_img, const MatchOffset offset) {
+    for (int y = 0; y < cluster_img.dimension(0); ++y) {
+        for (int x = 0; x < cluster_img.dimension(1); ++x) {
+            if (cluster_img(y, x) > 0)
+                canvas.mark(cluster, offset.y + y, offset.x + x);
+        }
+    }
+}
@@ -3,11 +3,29 @@
 #include <Eigen/Dense>
 #include <unsupported/Eigen/CXX11/Tensor>
 
+#include <vector>
+
 
 using ImageData = Eigen::Tensor<uint8_t, 3, Eigen::RowMajor>;
 using ImageTensor = Eigen::Tensor<uint8_t, 2, Eigen::RowMajor>;
+using LabelTensor = Eigen::Tensor<uint16_t, 2, Eigen::RowMajor>;
 static constexpr int IMAGE_DIM = 1;
 
+
+// Pixel claimed by another cluster after labels already holds one
+struct LabelOverlap {
+    int y;
+    int x;
+    uint16_t label;
+};
+
+// Compact alternative to ImageData, memory is proportional to the image area only
+struct LabelData {
+    ImageTensor image;
+    LabelTensor labels; // 0 is background, cluster i is stored as i + 1
+    std::vector<LabelOverlap> overlaps; // sorted by (y, x, label)
+};
+
 inline int pixel(const int c) {
     return ((c + 32) & ~63) >> 6;
 }
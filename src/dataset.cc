@@ -0,0 +1,382 @@
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "dataset.h"
+
+#include <stb_image.h>
+#include <stb_image_write.h>
+#include <fmt/format.h>
+
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+
+namespace {
+
+constexpr char DATA_MAGIC[4] = {'T', 'D', 'A', 'T'};
+constexpr char INDEX_MAGIC[4] = {'T', 'I', 'D', 'X'};
+constexpr uint32_t VERSION = 2;
+// Index header: magic, version, record count
+constexpr size_t INDEX_HEADER = 4 + 4 + 8;
+constexpr int DEFLATE_LEVEL = 6;
+
+static_assert(std::endian::native == std::endian::little, "Dataset records are written in native byte order");
+
+
+class Encoder {
+public:
+    template<typename T>
+    void put(const T value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        const size_t at = out.size();
+        out.resize(at + sizeof(T));
+        std::memcpy(out.data() + at, &value, sizeof(T));
+    }
+
+    void put_bytes(const void* bytes, const size_t n) {
+        out.append(static_cast<const char*>(bytes), n);
+    }
+
+    void put_string(const std::string& s) {
+        put(static_cast<uint32_t>(s.size()));
+        put_bytes(s.data(), s.size());
+    }
+
+    void put_deflated(const uint8_t* bytes, const size_t n) {
+        int length = 0;
+        unsigned char* z = stbi_zlib_compress(const_cast<uint8_t*>(bytes), static_cast<int>(n), &length, DEFLATE_LEVEL);
+        if (!z)
+            throw std::runtime_error("Failed to compress dataset record");
+        put(static_cast<uint64_t>(n));
+        put(static_cast<uint32_t>(length));
+        put_bytes(z, length);
+        std::free(z);
+    }
+
+    std::string out;
+};
+
+
+class Decoder {
+public:
+    Decoder(const uint8_t* data, const size_t size) : data(data), size(size) {
+    }
+
+    template<typename T>
+    T get() {
+        T value;
+        std::memcpy(&value, take(sizeof(T)), sizeof(T));
+        return value;
+    }
+
+    void get_bytes(void* out, const size_t n) {
+        std::memcpy(out, take(n), n);
+    }
+
+    std::string get_string() {
+        const auto n = get<uint32_t>();
+        return {reinterpret_cast<const char*>(take(n)), n};
+    }
+
+    std::vector<uint8_t> get_inflated() {
+        const auto n = get<uint64_t>();
+        const auto length = get<uint32_t>();
+        int inflated = 0;
+        char* raw = stbi_zlib_decode_malloc(reinterpret_cast<const char*>(take(length)), static_cast<int>(length), &inflated);
+        if (!raw || static_cast<uint64_t>(inflated) != n) {
+            std::free(raw);
+            throw std::runtime_error("Corrupt dataset record");
+        }
+        std::vector<uint8_t> out(raw, raw + inflated);
+        std::free(raw);
+        return out;
+    }
+
+private:
+    const uint8_t* take(const size_t n) {
+        if (n > size - pos)
+            throw std::runtime_error("Truncated dataset record");
+        const uint8_t* p = data + pos;
+        pos += n;
+        return p;
+    }
+
+    const uint8_t* data;
+    size_t size;
+    size_t pos = 0;
+};
+
+
+std::string encode(const Sample& s) {
+    Encoder e;
+    e.put_string(s.text);
+    e.put_string(s.font);
+    e.put_string(s.mode);
+    e.put(static_cast<uint32_t>(s.size));
+
+    const auto channels = static_cast<uint32_t>(s.image.dimension(0));
+    const auto h = static_cast<uint32_t>(s.image.dimension(1));
+    const auto w = static_cast<uint32_t>(s.image.dimension(2));
+    e.put(channels);
+    e.put(h);
+    e.put(w);
+
+    const size_t plane = static_cast<size_t>(h) * w;
+    const uint8_t* pixels = s.image.data();
+    e.put_deflated(pixels, channels ? plane : 0);
+
+    // Masks are 0 or 1, eight pixels to a byte with the first one in the high bit
+    const size_t mask_bits = channels > IMAGE_DIM ? (channels - IMAGE_DIM) * plane : 0;
+    std::vector<uint8_t> bits((mask_bits + 7) / 8, 0);
+    const uint8_t* masks = pixels + IMAGE_DIM * plane;
+    for (size_t i = 0; i < mask_bits; ++i) {
+        if (masks[i])
+            bits[i >> 3] |= static_cast<uint8_t>(0x80 >> (i & 7));
+    }
+    e.put_deflated(bits.data(), bits.size());
+
+    e.put(static_cast<uint32_t>(s.paths.size()));
+    for (const auto& path : s.paths) {
+        e.put(static_cast<uint32_t>(path.size()));
+        e.put_bytes(path.verbs().data(), path.size());
+        e.put(static_cast<uint32_t>(path.points().size()));
+        e.put_bytes(path.points().data(), path.points().size() * sizeof(Point));
+    }
+    e.put(static_cast<uint32_t>(s.advances.size()));
+    e.put_bytes(s.advances.data(), s.advances.size() * sizeof(float));
+    return std::move(e.out);
+}
+
+Path decode_path(Decoder& d) {
+    Path path;
+    const auto count = d.get<uint32_t>();
+    std::vector<CommandType> verbs(count);
+    d.get_bytes(verbs.data(), count);
+    const auto point_total = d.get<uint32_t>();
+    std::vector<Point> points(point_total);
+    d.get_bytes(points.data(), point_total * sizeof(Point));
+
+    path.reserve(count, point_total);
+    size_t at = 0;
+    for (const CommandType type : verbs) {
+        if (static_cast<uint8_t>(type) > static_cast<uint8_t>(CommandType::CLOSE) || at + point_count(type) > points.size())
+            throw std::runtime_error("Corrupt dataset record");
+        path.append(type, points.data() + at);
+        at += point_count(type);
+    }
+    if (at != points.size())
+        throw std::runtime_error("Corrupt dataset record");
+    return path;
+}
+
+Sample decode(const uint8_t* data, const size_t size) {
+    Decoder d(data, size);
+    Sample s;
+    s.text = d.get_string();
+    s.font = d.get_string();
+    s.mode = d.get_string();
+    s.size = d.get<uint32_t>();
+
+    const auto channels = d.get<uint32_t>();
+    const auto h = d.get<uint32_t>();
+    const auto w = d.get<uint32_t>();
+    const size_t plane = static_cast<size_t>(h) * w;
+    s.image = ImageData(channels, h, w);
+    s.image.setZero();
+
+    const std::vector<uint8_t> image = d.get_inflated();
+    if (image.size() != (channels ? plane : 0))
+        throw std::runtime_error("Corrupt dataset record");
+    std::copy(image.begin(), image.end(), s.image.data());
+
+    const std::vector<uint8_t> bits = d.get_inflated();
+    const size_t mask_bits = channels > IMAGE_DIM ? (channels - IMAGE_DIM) * plane : 0;
+    if (bits.size() != (mask_bits + 7) / 8)
+        throw std::runtime_error("Corrupt dataset record");
+    uint8_t* masks = s.image.data() + IMAGE_DIM * plane;
+    for (size_t i = 0; i < mask_bits; ++i)
+        masks[i] = (bits[i >> 3] >> (7 - (i & 7))) & 1;
+
+    const auto path_count = d.get<uint32_t>();
+    s.paths.reserve(path_count);
+    for (uint32_t p = 0; p < path_count; ++p)
+        s.paths.push_back(decode_path(d));
+    const auto advance_count = d.get<uint32_t>();
+    s.advances.reserve(advance_count);
+    for (uint32_t i = 0; i < advance_count; ++i)
+        s.advances.push_back(d.get<float>());
+    return s;
+}
+
+std::string index_path(const std::string& data_path) {
+    const size_t dot = data_path.rfind('.');
+    return (dot == std::string::npos ? data_path : data_path.substr(0, dot)) + ".tidx";
+}
+
+}
+
+
+DatasetWriter::DatasetWriter(std::string prefix, const size_t shard_bytes, const size_t queue_bytes)
+    : prefix(std::move(prefix)), shard_bytes(shard_bytes), queue_bytes(queue_bytes) {
+    writer = std::thread([this] { writer_loop(); });
+}
+
+DatasetWriter::~DatasetWriter() {
+    try {
+        close();
+    } catch (...) {
+    }
+}
+
+void DatasetWriter::write(const Sample& sample) {
+    std::string record = encode(sample);
+    std::unique_lock lock(mutex);
+    if (error)
+        std::rethrow_exception(error);
+    if (closing)
+        throw std::runtime_error("DatasetWriter is closed");
+    // A record bigger than the whole queue still goes through once the queue is empty
+    cv.wait(lock, [&] { return queued == 0 || queued + record.size() <= queue_bytes || error; });
+    if (error)
+        std::rethrow_exception(error);
+    queued += record.size();
+    queue.emplace_back(std::move(record));
+    cv.notify_all();
+}
+
+void DatasetWriter::close() {
+    {
+        std::lock_guard lock(mutex);
+        if (closed)
+            return;
+        closing = true;
+        closed = true;
+    }
+    cv.notify_all();
+    writer.join();
+    if (error)
+        std::rethrow_exception(error);
+}
+
+size_t DatasetWriter::records() const {
+    std::lock_guard lock(mutex);
+    return written;
+}
+
+size_t DatasetWriter::shards() const {
+    std::lock_guard lock(mutex);
+    return shard_count;
+}
+
+void DatasetWriter::open_shard() {
+    const std::string name = fmt::format("{}-{:05}", prefix, shard_count);
+    data.open(name + ".tdat", std::ios::binary | std::ios::trunc);
+    index.open(name + ".tidx", std::ios::binary | std::ios::trunc);
+    if (!data || !index)
+        throw std::runtime_error(fmt::format("Could not create dataset shard {}", name));
+
+    data.write(DATA_MAGIC, sizeof(DATA_MAGIC));
+    data.write(reinterpret_cast<const char*>(&VERSION), sizeof(VERSION));
+    const uint64_t unknown = 0;
+    index.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    index.write(reinterpret_cast<const char*>(&VERSION), sizeof(VERSION));
+    index.write(reinterpret_cast<const char*>(&unknown), sizeof(unknown));
+    shard_offset = sizeof(DATA_MAGIC) + sizeof(VERSION);
+    shard_records = 0;
+
+    std::lock_guard lock(mutex);
+    shard_count++;
+}
+
+// The record count goes into the index header last, a shard cut short by a crash reads as empty
+void DatasetWriter::finish_shard() {
+    index.seekp(sizeof(INDEX_MAGIC) + sizeof(VERSION));
+    index.write(reinterpret_cast<const char*>(&shard_records), sizeof(shard_records));
+    data.close();
+    index.close();
+    if (data.fail() || index.fail())
+        throw std::runtime_error("Failed to write dataset shard");
+}
+
+void DatasetWriter::writer_loop() {
+    try {
+        for (;;) {
+            std::string record;
+            {
+                std::unique_lock lock(mutex);
+                cv.wait(lock, [&] { return closing || !queue.empty(); });
+                if (queue.empty())
+                    break;
+                record = std::move(queue.front());
+                queue.pop_front();
+            }
+
+            if (!data.is_open() || (shard_records > 0 && shard_offset + record.size() > shard_bytes)) {
+                if (data.is_open())
+                    finish_shard();
+                open_shard();
+            }
+            const uint64_t entry[2] = {shard_offset, record.size()};
+            data.write(record.data(), static_cast<std::streamsize>(record.size()));
+            index.write(reinterpret_cast<const char*>(entry), sizeof(entry));
+            if (!data || !index)
+                throw std::runtime_error("Failed to write dataset shard");
+            shard_offset += record.size();
+            shard_records++;
+
+            std::lock_guard lock(mutex);
+            queued -= record.size();
+            written++;
+            cv.notify_all();
+        }
+        if (data.is_open())
+            finish_shard();
+    } catch (...) {
+        std::lock_guard lock(mutex);
+        error = std::current_exception();
+        cv.notify_all();
+    }
+}
+
+
+DatasetReader::DatasetReader(const std::string& path) {
+    std::unique_ptr<MappedFile> index_file;
+    try {
+        file = std::make_unique<MappedFile>(path);
+        index_file = std::make_unique<MappedFile>(index_path(path));
+    } catch (const std::runtime_error&) {
+        throw std::runtime_error(fmt::format("Could not open dataset shard {}", path));
+    }
+    const MappedFile& index = *index_file;
+    if (index.size() < INDEX_HEADER || std::memcmp(index.data(), INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0)
+        throw std::runtime_error(fmt::format("{} is not a dataset index", index_path(path)));
+    if (file->size() < sizeof(DATA_MAGIC) + sizeof(VERSION) || std::memcmp(file->data(), DATA_MAGIC, sizeof(DATA_MAGIC)) != 0)
+        throw std::runtime_error(fmt::format("{} is not a dataset shard", path));
+
+    uint32_t version;
+    std::memcpy(&version, file->data() + sizeof(DATA_MAGIC), sizeof(version));
+    if (version != VERSION)
+        throw std::runtime_error(fmt::format("{} has unsupported version {}", path, version));
+
+    uint64_t count;
+    std::memcpy(&count, index.data() + sizeof(INDEX_MAGIC) + sizeof(VERSION), sizeof(count));
+    if (INDEX_HEADER + count * 2 * sizeof(uint64_t) > index.size())
+        throw std::runtime_error(fmt::format("{} is truncated", index_path(path)));
+    offsets.resize(count);
+    lengths.resize(count);
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t entry[2];
+        std::memcpy(entry, index.data() + INDEX_HEADER + i * sizeof(entry), sizeof(entry));
+        if (entry[0] + entry[1] > file->size())
+            throw std::runtime_error(fmt::format("{} is truncated", path));
+        offsets[i] = entry[0];
+        lengths[i] = entry[1];
+    }
+}
+
+Sample DatasetReader::read(const size_t i) const {
+    if (i >= offsets.size())
+        throw std::out_of_range("Dataset record index out of range");
+    return decode(file->data() + offsets[i], lengths[i]);
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "common.h"
+#include "font_store.h"
+#include "path.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+struct Sample {
+    // Image in channel 0 and one mask per cluster after it, as render_text returns it
+    ImageData image;
+    std::vector<Path> paths;
+    std::vector<float> advances;
+    std::string text;
+    std::string font;
+    std::string mode;
+    unsigned size = 0;
+};
+
+
+// Writes samples to <prefix>-00000.tdat, <prefix>-00001.tdat, ... with a .tidx index next to
+// every shard. A record holds the metadata, the deflated image channel, the cluster masks as
+// deflated bit planes and the outlines. The index is a header followed by (offset, length)
+// pairs, so any record can be read without scanning its shard. All numbers are little endian,
+// they are copied in native order and the format only builds on little endian hosts.
+//
+// Records are encoded on the calling thread and written by a background thread. write only
+// blocks when more than queue_bytes are waiting for the disk.
+class DatasetWriter {
+public:
+    explicit DatasetWriter(std::string prefix, size_t shard_bytes = size_t{1} << 30, size_t queue_bytes = size_t{256} << 20);
+    ~DatasetWriter();
+
+    DatasetWriter(const DatasetWriter&) = delete;
+    DatasetWriter& operator=(const DatasetWriter&) = delete;
+
+    void write(const Sample& sample);
+    // Flushes everything queued and finishes the open shard. Rethrows a failed write.
+    void close();
+
+    size_t records() const;
+    size_t shards() const;
+
+private:
+    void writer_loop();
+    void open_shard();
+    void finish_shard();
+
+    std::string prefix;
+    size_t shard_bytes;
+    size_t queue_bytes;
+
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::string> queue;
+    size_t queued = 0;
+    size_t written = 0;
+    bool closing = false;
+    bool closed = false;
+    std::exception_ptr error;
+    std::thread writer;
+
+    // Only touched by the writer thread
+    std::ofstream data;
+    std::ofstream index;
+    uint64_t shard_offset = 0;
+    uint64_t shard_records = 0;
+    size_t shard_count = 0;
+};
+
+
+// Random access to the records of one shard
+class DatasetReader {
+public:
+    // Path of a .tdat shard, its .tidx is found next to it
+    explicit DatasetReader(const std::string& path);
+
+    size_t size() const { return offsets.size(); }
+    Sample read(size_t i) const;
+
+private:
+    std::unique_ptr<MappedFile> file;
+    std::vector<uint64_t> offsets;
+    std::vector<uint64_t> lengths;
+};
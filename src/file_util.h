@@ -0,0 +1,45 @@
+#pragma once
+
+#include <fmt/format.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+
+// Helpers shared by the files written into directories other processes use too
+
+inline uint64_t fnv1a(const void* data, const size_t size) {
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < size; ++i) {
+        h ^= bytes[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+inline uint64_t fnv1a(const std::string& s) {
+    return fnv1a(s.data(), s.size());
+}
+
+// Unique per process and call, so concurrent writers never share a temporary file. The pid
+// tells apart processes forked after the random value was drawn.
+inline std::string temp_suffix() {
+    static const uint64_t process = std::random_device{}() * 0x9e3779b97f4a7c15ull ^ std::random_device{}();
+    static std::atomic<uint64_t> counter{0};
+#ifdef _WIN32
+    const int pid = _getpid();
+#else
+    const int pid = static_cast<int>(getpid());
+#endif
+    return fmt::format(".{:016x}.{}.{}.tmp", process, pid, counter.fetch_add(1));
+}
@@ -0,0 +1,113 @@
+#include "font_store.h"
+
+#include <mutex>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path) {
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Invalid font: " + path);
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        CloseHandle(file);
+        throw std::runtime_error("Invalid font: " + path);
+    }
+    length = static_cast<size_t>(file_size.QuadPart);
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        CloseHandle(file);
+        throw std::runtime_error("Couldn't map font: " + path);
+    }
+    ptr = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!ptr) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        throw std::runtime_error("Couldn't map font: " + path);
+    }
+}
+
+MappedFile::~MappedFile() {
+    UnmapViewOfFile(ptr);
+    CloseHandle(mapping);
+    CloseHandle(file);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Invalid font: " + path);
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        throw std::runtime_error("Invalid font: " + path);
+    }
+    length = static_cast<size_t>(st.st_size);
+    void* mapped = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        throw std::runtime_error("Couldn't map font: " + path);
+    ptr = static_cast<const uint8_t*>(mapped);
+}
+
+MappedFile::~MappedFile() {
+    munmap(const_cast<uint8_t*>(ptr), length);
+}
+
+#endif
+
+
+FontStore& FontStore::shared() {
+    static FontStore store;
+    return store;
+}
+
+FontId FontStore::add(const std::string& path) {
+    {
+        std::shared_lock lock(mutex);
+        if (const auto it = ids.find(path); it != ids.end())
+            return it->second;
+    }
+
+    auto file = std::make_unique<MappedFile>(path);
+    std::unique_lock lock(mutex);
+    if (const auto it = ids.find(path); it != ids.end())
+        return it->second;
+    const auto id = static_cast<FontId>(files.size());
+    files.emplace_back(std::move(file));
+    paths.emplace_back(path);
+    ids.emplace(path, id);
+    return id;
+}
+
+const MappedFile& FontStore::file(const FontId id) const {
+    std::shared_lock lock(mutex);
+    if (id >= files.size())
+        throw std::out_of_range("Unknown font id: " + std::to_string(id));
+    return *files[id];
+}
+
+std::string FontStore::path(const FontId id) const {
+    std::shared_lock lock(mutex);
+    if (id >= paths.size())
+        throw std::out_of_range("Unknown font id: " + std::to_string(id));
+    return paths[id];
+}
+
+size_t FontStore::size() const {
+    std::shared_lock lock(mutex);
+    return files.size();
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+using FontId = uint32_t;
+
+
+// Read only mapping of a whole file. Pages come from the OS page cache, so every process that
+// maps the same font shares one resident copy.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* data() const { return ptr; }
+    size_t size() const { return length; }
+
+private:
+    const uint8_t* ptr = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+};
+
+
+// Process wide registry of font files. A path is mapped once and gets a dense id that
+// every Renderer can switch to in O(1).
+class FontStore {
+public:
+    static FontStore& shared();
+
+    FontId add(const std::string& path);
+    const MappedFile& file(FontId id) const;
+    std::string path(FontId id) const;
+    size_t size() const;
+
+private:
+    mutable std::shared_mutex mutex;
+    std::vector<std::unique_ptr<MappedFile>> files;
+    std::vector<std::string> paths;
+    std::unordered_map<std::string, FontId> ids;
+};
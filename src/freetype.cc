@@ -1,62 +1,84 @@
 #include "freetype.h"
+#include "stats.h"
 
 
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
 #include <ft2build.h>
 #include FT_GLYPH_H
 
 
-inline int div255(const int v) {
-    return ((v >> 8) + v) >> 8;
-}
-
-
-
-ImageData Freetype::render_text(const Shaper& shaper) {
-    const auto [x_min, x_max, y_min, y_max] = shaper.text_size();
-    const auto h = static_cast<Eigen::Index>(y_max - y_min);
-    const auto w = static_cast<Eigen::Index>(x_max - x_min);
-    const auto c = static_cast<Eigen::Index>(IMAGE_DIM + shaper.get_clusters().size());
-    ImageData img(c, h, w);
-    img.setZero();
+namespace {
 
-    img.chip<0>(0).setConstant(255);
+template<typename Canvas, typename... Args>
+typename Canvas::Output render(const Shaper& shaper, Args&&... args) {
+    const auto& clusters = shaper.get_clusters();
+    std::vector<std::shared_ptr<const CachedGlyph>> glyphs(shaper.get_glyph_count());
+    std::vector<std::pair<int, int>> origins(shaper.get_glyph_count());
+    Stats::add(Tally::GLYPHS, shaper.get_glyph_count());
+    Stats::add(Tally::CLUSTERS, clusters.size());
 
+    // The canvas is cropped to the ink, which is where the image differs from the background
+    TextBox ink{std::numeric_limits<int>::max(), std::numeric_limits<int>::min(), std::numeric_limits<int>::max(), std::numeric_limits<int>::min()};
+    std::optional<StageTimer> timer(std::in_place, Stage::GLYPH_LOAD);
     int x = 0;
-    for (unsigned i = 0; i < shaper.get_clusters().size(); i++) {
-        const auto& [_, cluster] = shaper.get_clusters()[i];
-        for (const unsigned glyph_id : cluster) {
-            if (FT_Load_Glyph(shaper.get_ft_face(), shaper.get_glyph_info()[glyph_id].codepoint, FT_LOAD_RENDER))
-                throw std::runtime_error("Glyph didn't load, render pass");
-
+    for (unsigned i = 0; i < clusters.size(); i++) {
+        for (const unsigned glyph_id : clusters[i]) {
+            const auto& glyph = glyphs[glyph_id] = shaper.load_glyph(glyph_id);
             const auto& pos = shaper.get_glyph_pos()[glyph_id];
-            const auto& bitmap = shaper.get_ft_face()->glyph->bitmap;
 
             const int px = pixel(x + pos.x_offset);
             const int py = pixel(pos.y_offset);
+            const auto& [left, top] = origins[glyph_id] = {px + glyph->bitmap_left, -(py + glyph->bitmap_top)};
 
-            const unsigned pos_x = -x_min + px + shaper.get_ft_face()->glyph->bitmap_left;
-            const unsigned pos_y = -(-y_max + py + shaper.get_ft_face()->glyph->bitmap_top);
-            for (unsigned row = 0; row < bitmap.rows; row++) {
-                for (unsigned col = 0; col < bitmap.width; col++) {
-                    // if (glyph_alpha > 0) {
-                    //     int current_alpha = img(gpy, gpx);
-                    //     img(gpy, gpx) = current_alpha > 0 ? glyph_alpha + div255(current_alpha * (255 - glyph_alpha) + 128) : glyph_alpha;
-                    // }
-                    const int glyph_alpha = bitmap.buffer[row * bitmap.pitch + col];
-                    if (glyph_alpha == 0)
-                        continue;
-                    const unsigned gpx = pos_x + col;
-                    const unsigned gpy = pos_y + row;
-
-                    img(IMAGE_DIM + i, gpy, gpx) = 1;
-
-                    uint8_t& current_alpha = img(0, gpy, gpx);
-                    current_alpha = div255(static_cast<int>(current_alpha) * (255 - glyph_alpha) + 128);
-                }
+            if (glyph->ink_x1 > glyph->ink_x0) {
+                ink.x_min = std::min(ink.x_min, left + glyph->ink_x0);
+                ink.x_max = std::max(ink.x_max, left + glyph->ink_x1);
+                ink.y_min = std::min(ink.y_min, top + glyph->ink_y0);
+                ink.y_max = std::max(ink.y_max, top + glyph->ink_y1);
             }
             x += pos.x_advance;
         }
     }
+    if (ink.x_max < ink.x_min)
+        ink = {};
+    timer.emplace(Stage::COMPOSITE);
+
+    const auto h = static_cast<Eigen::Index>(ink.y_max - ink.y_min);
+    const auto w = static_cast<Eigen::Index>(ink.x_max - ink.x_min);
+    Canvas img(std::forward<Args>(args)..., static_cast<Eigen::Index>(clusters.size()), h, w);
+
+    img.fill_image(255);
+
+    for (unsigned i = 0; i < clusters.size(); i++) {
+        for (const unsigned glyph_id : clusters[i]) {
+            const auto& glyph = glyphs[glyph_id];
+
+            const int pos_x = origins[glyph_id].first - ink.x_min;
+            const int pos_y = origins[glyph_id].second - ink.y_min;
+            for (int row = glyph->ink_y0; row < glyph->ink_y1; row++)
+                img.composite_row(i, pos_y + row, pos_x + glyph->ink_x0, glyph->bitmap.data() + row * glyph->width + glyph->ink_x0, glyph->ink_x1 - glyph->ink_x0);
+        }
+    }
+
+    return img.finish();
+}
+
+}
+
+
+ImageData Freetype::render_text(const Shaper& shaper) {
+    return render<ChannelCanvas>(shaper);
+}
+
+LabelData Freetype::render_labels(const Shaper& shaper) {
+    return render<LabelCanvas>(shaper);
+}
 
-    return img;
+ImageDims Freetype::render_into(const Shaper& shaper, const ImageView& out) {
+    return render<ViewCanvas>(shaper, out);
 }
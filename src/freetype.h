@@ -2,6 +2,7 @@
 
 #include "shaper.h"
 #include "common.h"
+#include "canvas.h"
 
 
 #include <limits>
@@ -11,4 +12,6 @@
 class Freetype {
 public:
     static ImageData render_text(const Shaper& shaper);
+    static LabelData render_labels(const Shaper& shaper);
+    static ImageDims render_into(const Shaper& shaper, const ImageView& out);
 };
@@ -0,0 +1,7 @@
+#include "glyph_cache.h"
+
+
+GlyphCache& glyph_cache() {
+    static GlyphCache cache(64 << 20);
+    return cache;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "lru_cache.h"
+
+#include <cstdint>
+#include <vector>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+
+struct GlyphKey {
+    uint64_t font;
+    // Variation instance, 0 for the font's default
+    uint64_t instance;
+    unsigned glyph;
+    unsigned size;
+    unsigned dpi;
+    // Entries for Shaper::text_size only carry the cbox
+    bool metrics_only;
+
+    bool operator==(const GlyphKey&) const = default;
+};
+
+struct GlyphKeyHash {
+    size_t operator()(const GlyphKey& k) const {
+        uint64_t h = k.font * 0x9E3779B97F4A7C15ull;
+        h ^= (static_cast<uint64_t>(k.glyph) << 32 | k.size) + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2);
+        h ^= k.dpi + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2);
+        h ^= k.instance + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2);
+        h ^= k.metrics_only;
+        return static_cast<size_t>(h);
+    }
+};
+
+
+// Everything the size and raster passes need from a hinted glyph at one size. Metrics only
+// entries leave the bitmap and ink bounds empty.
+struct CachedGlyph {
+    FT_BBox cbox;           // FT_GLYPH_BBOX_PIXELS
+    int bitmap_left;
+    int bitmap_top;
+    unsigned rows;
+    unsigned width;         // pitch of bitmap
+    std::vector<uint8_t> bitmap;
+
+    // Bounds of the nonzero part of bitmap, [x0, x1) x [y0, y1), empty when x1 <= x0
+    int ink_x0;
+    int ink_y0;
+    int ink_x1;
+    int ink_y1;
+};
+
+using GlyphCache = LruCache<GlyphKey, CachedGlyph, GlyphKeyHash>;
+
+// Shared by every Shaper in the process
+GlyphCache& glyph_cache();
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+struct CacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t entries;
+    size_t bytes;
+    size_t budget;
+};
+
+
+// Thread safe LRU map bounded by the summed cost of its entries. Split into shards with their
+// own lock so that threads rendering different glyphs rarely contend. Values are immutable and
+// handed out as shared_ptr, an evicted entry stays alive for whoever still holds it.
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class LruCache {
+public:
+    using Ptr = std::shared_ptr<const Value>;
+
+    explicit LruCache(const size_t budget, const unsigned shard_count = 16)
+        : shards(shard_count), budget(budget) {
+    }
+
+    Ptr get(const Key& key) {
+        Shard& shard = shard_for(key);
+        std::lock_guard lock(shard.mutex);
+        const auto it = shard.index.find(key);
+        if (it == shard.index.end()) {
+            misses.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+        hits.fetch_add(1, std::memory_order_relaxed);
+        return it->second->value;
+    }
+
+    // Returns the cached value, or builds it with make() outside of the lock and inserts it.
+    // make returns {value, cost in bytes}.
+    template<typename Make>
+    Ptr get_or_create(const Key& key, Make&& make) {
+        if (Ptr value = get(key))
+            return value;
+        auto [value, cost] = make();
+        return put(key, std::move(value), cost);
+    }
+
+    // Inserts unless another thread got there first, returns whichever value is cached
+    Ptr put(const Key& key, Ptr value, const size_t cost) {
+        const size_t shard_budget = budget.load(std::memory_order_relaxed) / shards.size();
+        if (cost > shard_budget)
+            return value;
+
+        Shard& shard = shard_for(key);
+        std::lock_guard lock(shard.mutex);
+        if (const auto it = shard.index.find(key); it != shard.index.end())
+            return it->second->value;
+
+        shard.entries.push_front({key, value, cost});
+        shard.index.emplace(key, shard.entries.begin());
+        shard.bytes += cost;
+        evict(shard, shard_budget);
+        return value;
+    }
+
+    void set_budget(const size_t bytes) {
+        budget = bytes;
+        for (auto& shard : shards) {
+            std::lock_guard lock(shard.mutex);
+            evict(shard, bytes / shards.size());
+        }
+    }
+
+    void clear() {
+        for (auto& shard : shards) {
+            std::lock_guard lock(shard.mutex);
+            shard.entries.clear();
+            shard.index.clear();
+            shard.bytes = 0;
+        }
+    }
+
+    CacheStats stats() const {
+        CacheStats s{hits.load(), misses.load(), evictions.load(), 0, 0, budget.load()};
+        for (auto& shard : shards) {
+            std::lock_guard lock(shard.mutex);
+            s.entries += shard.index.size();
+            s.bytes += shard.bytes;
+        }
+        return s;
+    }
+
+    void reset_stats() {
+        hits = 0;
+        misses = 0;
+        evictions = 0;
+    }
+
+private:
+    struct Entry {
+        Key key;
+        Ptr value;
+        size_t cost;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<Entry> entries;
+        std::unordered_map<Key, typename std::list<Entry>::iterator, Hash> index;
+        size_t bytes = 0;
+    };
+
+    Shard& shard_for(const Key& key) {
+        return shards[Hash{}(key) % shards.size()];
+    }
+
+    void evict(Shard& shard, const size_t shard_budget) {
+        while (shard.bytes > shard_budget && !shard.entries.empty()) {
+            const Entry& last = shard.entries.back();
+            shard.bytes -= last.cost;
+            shard.index.erase(last.key);
+            shard.entries.pop_back();
+            evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    std::vector<Shard> shards;
+    std::atomic<size_t> budget;
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> evictions{0};
+};
@@ -0,0 +1,157 @@
+#include "match.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MATCH_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MATCH_NEON
+#endif
+
+
+namespace {
+
+// Pyramid levels are only worth building when the exhaustive search is this expensive
+constexpr int64_t COARSE_MIN_WORK = 1 << 20;
+constexpr int COARSE_MIN_SIDE = 8;
+constexpr int REFINE_RADIUS = 2;
+
+
+// Sum of (t - f)^2 over the n pixels where t != 0
+inline uint64_t ssd_row(const uint8_t* t, const uint8_t* f, const int n) {
+    int i = 0;
+    uint64_t sum = 0;
+#if defined(MATCH_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i tv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(t + i));
+        const __m128i fv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(f + i));
+        __m128i ad = _mm_or_si128(_mm_subs_epu8(tv, fv), _mm_subs_epu8(fv, tv));
+        ad = _mm_andnot_si128(_mm_cmpeq_epi8(tv, zero), ad);
+        const __m128i lo = _mm_unpacklo_epi8(ad, zero);
+        const __m128i hi = _mm_unpackhi_epi8(ad, zero);
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(lo, lo));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(hi, hi));
+    }
+    alignas(16) uint32_t lanes[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes), acc);
+    sum = static_cast<uint64_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+#elif defined(MATCH_NEON)
+    uint32x4_t acc = vdupq_n_u32(0);
+    for (; i + 16 <= n; i += 16) {
+        const uint8x16_t tv = vld1q_u8(t + i);
+        const uint8x16_t fv = vld1q_u8(f + i);
+        const uint8x16_t ad = vandq_u8(vabdq_u8(tv, fv), vtstq_u8(tv, tv));
+        acc = vpadalq_u16(acc, vmull_u8(vget_low_u8(ad), vget_low_u8(ad)));
+        acc = vpadalq_u16(acc, vmull_u8(vget_high_u8(ad), vget_high_u8(ad)));
+    }
+#if defined(__aarch64__)
+    sum = vaddvq_u32(acc);
+#else
+    // ARMv7 has no across vector add
+    const uint32x2_t pairs = vpadd_u32(vget_low_u32(acc), vget_high_u32(acc));
+    sum = vget_lane_u32(vpadd_u32(pairs, pairs), 0);
+#endif
+#endif
+    for (; i < n; ++i) {
+        const int d = static_cast<int>(t[i]) - f[i];
+        sum += t[i] != 0 ? static_cast<uint64_t>(d * d) : 0;
+    }
+    return sum;
+}
+
+
+struct Search {
+    const uint8_t* templ;
+    const uint8_t* image;
+    int th, tw, fh, fw;
+    int window_start, window_end;
+    int start_x, end_x, end_y;
+
+    Search(const ImageTensor& t, const ImageTensor& f, const int window_start, const int window_end)
+        : templ(t.data()), image(f.data()),
+          th(static_cast<int>(t.dimension(0))), tw(static_cast<int>(t.dimension(1))),
+          fh(static_cast<int>(f.dimension(0))), fw(static_cast<int>(f.dimension(1))),
+          window_start(window_start), window_end(window_end) {
+        start_x = std::max(0, window_start - tw + 1);
+        end_x = std::min(fw - tw, window_end - 1);
+        end_y = fh - th;
+    }
+
+    // Loss at (y, x), gives up with something > bound once the partial sum exceeds it
+    uint64_t loss(const int y, const int x, const uint64_t bound) const {
+        const int tx_start = std::max(0, window_start - x);
+        const int tx_end = std::min(tw, window_end - x);
+        if (tx_end <= tx_start)
+            return 0;
+        uint64_t sum = 0;
+        for (int ty = 0; ty < th && sum <= bound; ++ty)
+            sum += ssd_row(templ + ty * tw + tx_start, image + (y + ty) * fw + x + tx_start, tx_end - tx_start);
+        return sum;
+    }
+};
+
+
+struct Best {
+    uint64_t loss = std::numeric_limits<uint64_t>::max();
+    int y = 0;
+    int x = 0;
+
+    void offer(const uint64_t l, const int oy, const int ox) {
+        if (l < loss || (l == loss && (oy < y || (oy == y && ox < x)))) {
+            loss = l;
+            y = oy;
+            x = ox;
+        }
+    }
+};
+
+
+// 2x2 box filter, keeps a pixel nonzero when any of its sources is
+ImageTensor downsample(const ImageTensor& img) {
+    const Eigen::Index h = img.dimension(0) / 2;
+    const Eigen::Index w = img.dimension(1) / 2;
+    ImageTensor out(h, w);
+    for (Eigen::Index y = 0; y < h; ++y) {
+        for (Eigen::Index x = 0; x < w; ++x) {
+            const int a = img(2 * y, 2 * x), b = img(2 * y, 2 * x + 1);
+            const int c = img(2 * y + 1, 2 * x), d = img(2 * y + 1, 2 * x + 1);
+            const int sum = a + b + c + d;
+            out(y, x) = static_cast<uint8_t>(sum == 0 ? 0 : std::max(1, (sum + 2) / 4));
+        }
+    }
+    return out;
+}
+
+}
+
+
+MatchOffset match_template(const ImageTensor& templ, const ImageTensor& image, const int window_start, const int window_end) {
+    const Search search(templ, image, window_start, window_end);
+    Best best;
+    if (search.end_y < 0 || search.end_x < search.start_x)
+        return {0, 0};
+
+    // A coarse match at half resolution gives a tight bound, so most offsets of the exact
+    // search below stop after a few rows. The result is still the exhaustive minimum.
+    const int64_t work = static_cast<int64_t>(search.end_y + 1) * (search.end_x - search.start_x + 1) * search.th * search.tw;
+    if (work >= COARSE_MIN_WORK && search.th >= COARSE_MIN_SIDE && search.tw >= COARSE_MIN_SIDE) {
+        const ImageTensor coarse_templ = downsample(templ);
+        const ImageTensor coarse_image = downsample(image);
+        const auto [cy, cx] = match_template(coarse_templ, coarse_image, window_start / 2, (window_end + 1) / 2);
+        for (int y = std::max(0, 2 * cy - REFINE_RADIUS); y <= std::min(search.end_y, 2 * cy + REFINE_RADIUS); ++y)
+            for (int x = std::max(search.start_x, 2 * cx - REFINE_RADIUS); x <= std::min(search.end_x, 2 * cx + REFINE_RADIUS); ++x)
+                best.offer(search.loss(y, x, best.loss), y, x);
+    }
+
+    for (int y = 0; y <= search.end_y; ++y)
+        for (int x = search.start_x; x <= search.end_x; ++x)
+            best.offer(search.loss(y, x, best.loss), y, x);
+
+    return {best.y, best.x};
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "common.h"
+
+
+struct MatchOffset {
+    int y;
+    int x;
+};
+
+
+// Offset of templ inside image with the least squared difference over the nonzero pixels of
+// templ, counting only template columns that land in [window_start, window_end). Ties go to
+// the first offset in row major order. Sums are exact integers.
+MatchOffset match_template(const ImageTensor& templ, const ImageTensor& image, int window_start, int window_end);
@@ -1,19 +1,44 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "myfonts.h"
+#include "cluster_mask.h"
+#include "response_cache.h"
+#include "request_scheduler.h"
+#include "stats.h"
+#include "thread_pool.h"
 #include <fmt/format.h>
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <mutex>
 
 
 
-inline cpr::Url get_url(const std::string& myfonts_id) {
-    return cpr::Url{fmt::format(
-        "https://sig.monotype.com/render/105/font/{}",
-        myfonts_id
-    )};
+namespace {
+
+std::mutex endpoint_mutex;
+std::string endpoint_url = "https://sig.monotype.com/render/105/font/";
+
+}
+
+void MyFonts::set_endpoint(const std::string& url) {
+    std::lock_guard lock(endpoint_mutex);
+    endpoint_url = url;
+}
+
+std::string MyFonts::endpoint() {
+    std::lock_guard lock(endpoint_mutex);
+    return endpoint_url;
 }
 
-inline cpr::Parameters get_params(const std::string& text, const unsigned font_size, const unsigned spacing) {
-    return cpr::Parameters{
+
+inline std::string get_url(const std::string& myfonts_id) {
+    return MyFonts::endpoint() + myfonts_id;
+}
+
+inline std::vector<cpr::Parameter> get_params(const std::string& text, const unsigned font_size, const unsigned spacing) {
+    return {
         {"rt", text},
         {"rs", std::to_string(font_size)},
         {"w", "4000"},
@@ -27,237 +52,378 @@ inline cpr::Parameters get_params(const std::string& text, const unsigned font_s
     };
 }
 
+// Length prefixed, so that no text can make two requests collide
+std::string request_key(const std::string& url, const std::vector<cpr::Parameter>& params) {
+    std::string key = fmt::format("{}:{}", url.size(), url);
+    for (const auto& param : params)
+        fmt::format_to(std::back_inserter(key), ";{}:{}={}:{}", param.key.size(), param.key, param.value.size(), param.value);
+    return key;
+}
 
-OwnedImage load_img(const cpr::Response& res) {
-    if (res.status_code != 200)
-        throw std::runtime_error(fmt::format("MyFonts request failed with status: {}", res.status_code));
+
+void fetch(const std::string& url, const std::vector<cpr::Parameter>& params, FetchDone done) {
+    Stats::add(Tally::REQUESTS);
+    std::string key = request_key(url, params);
+    if (std::optional<std::string> cached = ResponseCache::shared().get(key)) {
+        Stats::add(Tally::RESPONSE_CACHE_HITS);
+        return done(std::move(*cached), nullptr);
+    }
+
+    const auto submitted = Stats::enabled() ? Stats::Clock::now() : Stats::Clock::time_point{};
+    RequestScheduler::shared().submit(url, params, [key = std::move(key), done = std::move(done), submitted](cpr::Response res) {
+        if (submitted != Stats::Clock::time_point{})
+            Stats::record(Stage::HTTP, submitted, Stats::Clock::now());
+        if (res.status_code != 200)
+            return done({}, std::make_exception_ptr(std::runtime_error(fmt::format("MyFonts request failed with status: {}", res.status_code))));
+        Stats::add(Tally::RESPONSE_BYTES, res.text.size());
+        ResponseCache::shared().put(key, res.text);
+        done(std::move(res.text), nullptr);
+    });
+}
+
+
+OwnedImage load_img(const std::string& body) {
+    const StageTimer timer(Stage::DECODE);
     int width, height, comp;
-    unsigned char* data = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(res.text.data()), res.text.size(), &width, &height, &comp, 1);
+    unsigned char* data = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(body.data()), body.size(), &width, &height, &comp, 1);
     if (!data)
         throw std::runtime_error("Failed to load image from MyFonts response");
     return {data, height, width};
 }
 
 
-std::vector<Responses> queue_requests(const std::vector<ClusterPair>& cluster_pairs, const unsigned font_size, const std::string& myfonts_id, const Shaper& shaper, const unsigned max_cluster_width) {
-    std::vector<Responses> responses;
-    responses.reserve(IMAGE_DIM + cluster_pairs.size());
-    const cpr::Url base = get_url(myfonts_id);
-    responses.emplace_back(cpr::GetAsync(base, get_params(shaper.get_text(), font_size, 0)), std::nullopt);
-    for (const auto& [text, last] : cluster_pairs) {
-        Responses r;
-        r.first = cpr::GetAsync(base, get_params(text, font_size, 0));
-        if (!last)
-            r.second = cpr::GetAsync(base, get_params(text, font_size, max_cluster_width));
-        responses.emplace_back(std::move(r));
+ImageTensor cluster_template(OwnedImage& unspaced, OwnedImage* spaced) {
+    const StageTimer timer(Stage::TEMPLATE);
+    if (!spaced) {
+        const auto& [offsets, extents] = nonzero(unspaced.view(), unspaced.dims());
+        return unspaced.view().slice(offsets, extents);
     }
-    return responses;
-}
 
-template<typename Tensor>
-void invert_inplace(Tensor&& img) {
-    const auto size = img.size();
-    auto* ptr = img.data();
-    for (size_t i = 0; i < size; ++i) {
-        ptr[i] = 255 - ptr[i];
+    int x = 0;
+    for (; x < spaced->w(); ++x) {
+        for (int y = 0; y < spaced->h(); ++y) {
+            if (spaced->view()(y, x) > unspaced.view()(y, x))
+                goto found_x;
+        }
     }
-}
+found_x:
 
+    Eigen::array<Eigen::Index, 2> search_dims({spaced->h(), x});
+    const auto& [offsets, extents] = nonzero(spaced->view(), search_dims);
+    return spaced->view().slice(offsets, extents);
+}
 
-template<typename Image, typename Dims>
-std::pair<Eigen::array<Eigen::Index, 2>, Eigen::array<Eigen::Index, 2>> nonzero(const Image& img, const Dims& dims, const bool wonb = true) {
-    TextBox box{};
 
-    const uint8_t bg = wonb ? 0 : 255;
+namespace {
+
+struct ClusterTemplate {
+    ImageTensor image;
+    int window_start;
+    // The last cluster may match anywhere right of its window start
+    bool to_end;
+};
+
+
+// State of one render shared by request callbacks and pool tasks. Responses are decoded as
+// they arrive, a cluster is cut out once both its images are in and matched as soon as the
+// full image is. Whichever thread finishes the last of it runs done, nobody has to wait.
+template<typename Canvas>
+struct Pipeline : std::enable_shared_from_this<Pipeline<Canvas>> {
+    std::mutex mutex;
+    std::condition_variable cv;
+    // Requests and tasks not finished yet
+    size_t outstanding = 0;
+    // Decode and match tasks not picked up yet, run by the pool or by a waiting render
+    std::deque<std::function<void(Pipeline&)>> tasks;
+    std::exception_ptr error;
+    // Builds the canvas once the size of the full image is known
+    std::function<void(Pipeline&, Eigen::Index h, Eigen::Index w)> make_canvas;
+    std::function<void(Pipeline&)> done;
+
+    std::vector<std::optional<OwnedImage>> unspaced;
+    std::vector<std::optional<OwnedImage>> spaced;
+    // Filled before any request is sent and read only afterwards
+    std::vector<bool> has_spaced;
+    std::vector<ClusterWindow> windows;
+    std::vector<std::optional<ClusterTemplate>> templates;
+    std::vector<MatchOffset> offsets;
+
+    // Set before matching starts and read only afterwards
+    std::optional<Canvas> canvas;
+    ImageTensor target;
+    bool matching = false;
+
+    void fail(std::exception_ptr e) {
+        std::lock_guard lock(mutex);
+        if (!error)
+            error = e;
+    }
 
-    for (int y = 0; y < dims[0]; ++y) {
-        for (int x = 0; x < dims[1]; ++x) {
-            if (img(y, x) != bg) {
-                box.y_min = y;
-                goto found_top;
-            }
+    void finish() {
+        bool last;
+        {
+            std::lock_guard lock(mutex);
+            last = --outstanding == 0;
         }
-    }
-found_top:
-    for (int y = dims[0] - 1; y >= 0; --y) {
-        for (int x = 0; x < dims[1]; ++x) {
-            if (img(y, x) != bg) {
-                box.y_max = y;
-                goto found_bottom;
-            }
+        if (last) {
+            cv.notify_all();
+            if (done)
+                done(*this);
         }
     }
-found_bottom:
-    for (int x = 0; x < dims[1]; ++x) {
-        for (int y = 0; y < dims[0]; ++y) {
-            if (img(y, x) != bg) {
-                box.x_min = x;
-                goto found_left;
-            }
+
+    void run(const std::function<void(Pipeline&)>& task) {
+        try {
+            task(*this);
+        } catch (...) {
+            fail(std::current_exception());
         }
+        finish();
     }
-found_left:
-    for (int x = dims[1] - 1; x >= 0; --x) {
-        for (int y = 0; y < dims[0]; ++y) {
-            if (img(y, x) != bg) {
-                box.x_max = x;
-                goto found_right;
+
+    // Called with the mutex held. The pool gets one wake up per task, which finds nothing to
+    // do when a waiting render took the task first.
+    void post_locked(std::function<void(Pipeline&)> task) {
+        outstanding++;
+        tasks.push_back(std::move(task));
+        ThreadPool::shared().submit([self = this->shared_from_this()] {
+            std::function<void(Pipeline&)> next;
+            {
+                std::lock_guard lock(self->mutex);
+                if (self->tasks.empty())
+                    return;
+                next = std::move(self->tasks.front());
+                self->tasks.pop_front();
             }
-        }
+            self->run(next);
+        });
+        cv.notify_all();
     }
-found_right:
-
-    Eigen::array<Eigen::Index, 2> offsets = {box.y_min, box.x_min};
-    Eigen::array<Eigen::Index, 2> extents = {box.y_max - box.y_min + 1, box.x_max - box.x_min + 1};
-    return {offsets, extents};
-}
-
-
 
+    void post(std::function<void(Pipeline&)> task) {
+        std::lock_guard lock(mutex);
+        post_locked(std::move(task));
+    }
 
+    // slot 0 is the full image, slot 2 * i + 1 and 2 * i + 2 the unspaced and spaced images of cluster i
+    void request(const std::string& url, const std::vector<cpr::Parameter>& params, const size_t slot) {
+        {
+            std::lock_guard lock(mutex);
+            outstanding++;
+        }
+        fetch(url, params, [self = this->shared_from_this(), slot](std::string body, std::exception_ptr e) {
+            if (e)
+                self->fail(e);
+            else
+                self->post([slot, body = std::move(body)](Pipeline& p) { p.decoded(slot, load_img(body)); });
+            self->finish();
+        });
+    }
 
+    void decoded(const size_t slot, OwnedImage img) {
+        if (slot == 0)
+            return start_matching(img);
+
+        invert_inplace(img.view());
+        const size_t cluster = (slot - 1) / 2;
+        std::optional<OwnedImage> first;
+        std::optional<OwnedImage> second;
+        {
+            std::lock_guard lock(mutex);
+            (slot % 2 ? unspaced : spaced)[cluster].emplace(std::move(img));
+            if (!unspaced[cluster] || (has_spaced[cluster] && !spaced[cluster]))
+                return;
+            first = std::move(unspaced[cluster]);
+            second = std::move(spaced[cluster]);
+        }
 
+        ClusterTemplate templ{
+            cluster_template(*first, second ? &*second : nullptr),
+            windows[cluster].x,
+            !has_spaced[cluster]
+        };
+        std::lock_guard lock(mutex);
+        templates[cluster].emplace(std::move(templ));
+        if (matching)
+            post_match(cluster);
+    }
 
-void fill_cluster_mask(
-            ImageData& img_data,
-            const unsigned channel,
-            const ImageTensor& cluster_img,
-            const ImageTensor& full_img,
-            const int window_start,
-            const int window_end
-        ) {
-    const int th = cluster_img.dimension(0);
-    const int tw = cluster_img.dimension(1);
-    const int fh = full_img.dimension(0);
-    const int fw = full_img.dimension(1);
-    const int start_x = std::max(0, window_start - tw + 1);
-    const int end_x = std::min(fw - tw, window_end - 1);
-    constexpr int start_y = 0;
-    const int end_y = fh - th;
-
-    float min_loss = std::numeric_limits<float>::infinity();
-    int best_y = 0;
-    int best_x = 0;
-
-    for (int y = start_y; y <= end_y; ++y) {
-        for (int x = start_x; x <= end_x; ++x) {
-            const int tx_start = std::max(0, window_start - x);
-            const int tx_end = std::min(tw, window_end - x);
-
-            float sqdiff = 0.0f;
-            for (int ty = 0; ty < th; ++ty) {
-                for (int tx = tx_start; tx < tx_end; ++tx) {
-                    // assert(tx >= 0 && tx < tw);
-                    // assert(ty >= 0 && ty < th);
-                    if (!(tx >= 0 && tx < tw))
-                        throw std::runtime_error("tx out of bounds");
-                    if (!(ty >= 0 && ty < th))
-                        throw std::runtime_error("ty out of bounds");
-                    if (cluster_img(ty, tx) != 0) {
-                        const float diff = cluster_img(ty, tx) - full_img(y + ty, x + tx);
-                        sqdiff += diff * diff;
-                    }
-                }
-            }
+    // Called with the mutex held
+    void post_match(const size_t cluster) {
+        post_locked([cluster](Pipeline& p) { p.match(cluster); });
+    }
 
-            if (sqdiff < min_loss) {
-                min_loss = sqdiff;
-                best_y = y;
-                best_x = x;
-            }
+    void match(const size_t cluster) {
+        const ClusterTemplate& templ = *templates[cluster];
+        const int window_end = templ.to_end ? static_cast<int>(target.dimension(1)) : windows[cluster].end;
+        MatchOffset offset;
+        {
+            const StageTimer timer(Stage::MATCH);
+            offset = match_template(templ.image, target, templ.window_start, window_end);
+        }
+        if constexpr (Canvas::concurrent_marks) {
+            const StageTimer timer(Stage::MARK);
+            mark_cluster(*canvas, static_cast<unsigned>(cluster), templ.image, offset);
+        } else {
+            offsets[cluster] = offset;
         }
     }
 
-    for (int y = 0; y < th; ++y) {
-        for (int x = 0; x < tw; ++x) {
-            img_data(channel, best_y + y, best_x + x) = cluster_img(y, x) > 0 ? 1 : 0;
+    void start_matching(OwnedImage& full) {
+        const auto nz_full = nonzero(full.view(), full.dims(), false);
+        make_canvas(*this, nz_full.second[0], nz_full.second[1]);
+        ImageTensor img = full.view().slice(nz_full.first, nz_full.second);
+        for (Eigen::Index y = 0; y < img.dimension(0); ++y)
+            std::copy_n(img.data() + y * img.dimension(1), img.dimension(1), canvas->image_row(y));
+        invert_inplace(img);
+
+        std::lock_guard lock(mutex);
+        target = std::move(img);
+        matching = true;
+        for (size_t i = 0; i < templates.size(); ++i) {
+            if (templates[i])
+                post_match(i);
         }
     }
 
-}
-
+    // Once nothing is outstanding
+    typename Canvas::Output result() {
+        if (error)
+            std::rethrow_exception(error);
 
+        Stats::add(Tally::CLUSTERS, templates.size());
+        if constexpr (!Canvas::concurrent_marks) {
+            const StageTimer timer(Stage::MARK);
+            for (size_t i = 0; i < templates.size(); ++i)
+                mark_cluster(*canvas, static_cast<unsigned>(i), templates[i]->image, offsets[i]);
+        }
+        return canvas->finish();
+    }
+};
 
 
-ImageData MyFonts::render_text(const Shaper& shaper, const unsigned font_size, const std::string& myfonts_id) {
-    std::vector<ClusterPair> urls_to_get;
+// Sends every request of a render. The pipeline runs done once all of them and the work on
+// their responses finished, which may be before this returns.
+template<typename Canvas, typename... Args>
+std::shared_ptr<Pipeline<Canvas>> start(const Shaper& shaper, const unsigned font_size, const std::string& myfonts_id, std::function<void(Pipeline<Canvas>&)> done, Args... args) {
     const std::vector<std::string> strings = shaper.cluster_strings();
-    const std::vector<ClusterWindow> windows = shaper.get_cluster_windows();
     unsigned max_width;
     shaper.text_size(&max_width);
+    const unsigned spacing = static_cast<unsigned>(max_width * 1.5f); // extra gap just in case
+
+    auto pipeline = std::make_shared<Pipeline<Canvas>>();
+    Pipeline<Canvas>& p = *pipeline;
+    const size_t clusters = strings.size();
+    p.unspaced.resize(clusters);
+    p.spaced.resize(clusters);
+    // Every cluster but the last is cut out of a spaced pair. Set before the first request, the
+    // callbacks of early responses read it.
+    p.has_spaced.assign(clusters, true);
+    if (clusters > 0)
+        p.has_spaced[clusters - 1] = false;
+    p.windows = shaper.get_cluster_windows();
+    p.templates.resize(clusters);
+    p.offsets.resize(clusters);
+    p.make_canvas = [clusters, args...](Pipeline<Canvas>& owner, const Eigen::Index h, const Eigen::Index w) {
+        owner.canvas.emplace(args..., static_cast<Eigen::Index>(clusters), h, w);
+    };
+    p.done = std::move(done);
 
-
-
-
-    urls_to_get.reserve(strings.size());
-    for (size_t i = 0; i < strings.size(); ++i) {
-        ClusterPair p;
-        const std::string& first = strings[i];
-        if (i < strings.size() - 1) {
-            p.text = first + strings[i + 1];
-            p.last = false;
-        } else {
-            p.text = first;
-            p.last = true;
+    // Held while sending, so that early responses can't finish the render before the last request
+    {
+        std::lock_guard lock(p.mutex);
+        p.outstanding++;
+    }
+    try {
+        const std::string base = get_url(myfonts_id);
+        p.request(base, get_params(shaper.get_text(), font_size, 0), 0);
+        for (size_t i = 0; i < clusters; ++i) {
+            if (i < clusters - 1) {
+                const std::string pair = strings[i] + strings[i + 1];
+                p.request(base, get_params(pair, font_size, 0), 2 * i + 1);
+                p.request(base, get_params(pair, font_size, spacing), 2 * i + 2);
+            } else {
+                p.request(base, get_params(strings[i], font_size, 0), 2 * i + 1);
+            }
         }
-        urls_to_get.emplace_back(std::move(p));
+    } catch (...) {
+        p.fail(std::current_exception());
     }
-    std::vector<Responses> responses = queue_requests(urls_to_get, font_size, myfonts_id, shaper, static_cast<unsigned>(max_width * 1.5f)); // extra gap just in case
-
-
-
-    OwnedImage img_og{load_img(responses[0].first.get())};
-    const auto nz_full = nonzero(img_og.view(), img_og.dims(), false);
-
-    const auto c = static_cast<Eigen::Index>(IMAGE_DIM + strings.size());
-    ImageData img_data(c, nz_full.second[0], nz_full.second[1]);
-    img_data.setZero();
-
-    ImageTensor img = img_og.view().slice(nz_full.first, nz_full.second);
-    img_data.chip<0>(0) = img;
-    invert_inplace(img);
+    p.finish();
+    return pipeline;
+}
 
 
+// Runs the render's own queued tasks until nothing of it is outstanding, so a render waiting on
+// a pool thread still makes progress. Work of other renders is left to the pool.
+template<typename Canvas>
+typename Canvas::Output await_render(Pipeline<Canvas>& p) {
+    for (;;) {
+        std::function<void(Pipeline<Canvas>&)> task;
+        {
+            std::unique_lock lock(p.mutex);
+            p.cv.wait(lock, [&] { return p.outstanding == 0 || !p.tasks.empty(); });
+            if (p.outstanding == 0)
+                break;
+            task = std::move(p.tasks.front());
+            p.tasks.pop_front();
+        }
+        p.run(task);
+    }
+    return p.result();
+}
 
 
-    for (int i = IMAGE_DIM; i < responses.size(); ++i) {
-        auto& [unspaced_res, spaced_res] = responses[i];
-        OwnedImage unspaced{load_img(unspaced_res.get())};
-        invert_inplace(unspaced.view());
+template<typename Canvas, typename... Args>
+typename Canvas::Output render(const Shaper& shaper, const unsigned font_size, const std::string& myfonts_id, Args&&... args) {
+    return await_render(*start<Canvas>(shaper, font_size, myfonts_id, nullptr, std::forward<Args>(args)...));
+}
 
-        const ClusterWindow& window = windows[i - IMAGE_DIM];
+}
 
-        if (spaced_res.has_value()) {
-            OwnedImage spaced{load_img(spaced_res->get())};
-            invert_inplace(spaced.view());
 
-            int x = 0;
-            for (; x < spaced.w(); ++x) {
-                for (int y = 0; y < spaced.h(); ++y) {
-                    if (spaced.view()(y, x) > unspaced.view()(y, x))
-                        goto found_x;
-                }
-            }
-        found_x:
+ImageData MyFonts::render_text(const Shaper& shaper, const unsigned font_size, const std::string& myfonts_id) {
+    return render<ChannelCanvas>(shaper, font_size, myfonts_id);
+}
 
-            Eigen::array<Eigen::Index, 2> search_dims({spaced.h(), x});
-            const auto& [offsets, extents] = nonzero(spaced.view(), search_dims);
+LabelData MyFonts::render_labels(const Shaper& shaper, const unsigned font_size, const std::string& myfonts_id) {
+    return render<LabelCanvas>(shaper, font_size, myfonts_id);
+}
 
+ImageDims MyFonts::render_into(const Shaper& shaper, const unsigned font_size, const std::string& myfonts_id, const ImageView& out) {
+    return render<ViewCanvas>(shaper, font_size, myfonts_id, out);
+}
 
-            ImageTensor cluster = spaced.view().slice(offsets, extents);
-            fill_cluster_mask(img_data, i, cluster, img, window.x, window.end);
+std::vector<ImageData> MyFonts::render_text_sizes(Shaper& shaper, const std::vector<unsigned>& font_sizes, const std::string& myfonts_id) {
+    // Every size is sent before the first one is waited for, so all requests share the sessions
+    std::vector<std::shared_ptr<Pipeline<ChannelCanvas>>> pipelines;
+    pipelines.reserve(font_sizes.size());
+    for (const unsigned font_size : font_sizes) {
+        shaper.shape(font_size);
+        pipelines.push_back(start<ChannelCanvas>(shaper, font_size, myfonts_id, nullptr));
+    }
 
+    std::vector<ImageData> images;
+    images.reserve(font_sizes.size());
+    for (const auto& pipeline : pipelines)
+        images.push_back(await_render(*pipeline));
+    return images;
+}
 
-        } else {
-            const auto& [offsets, extents] = nonzero(
-                unspaced.view(), unspaced.dims()
-            );
-            ImageTensor cluster = unspaced.view().slice(offsets, extents);
 
-            fill_cluster_mask(img_data, i, cluster, img, window.x, img.dimension(1));
+void MyFonts::render_text_async(const Shaper& shaper, const unsigned font_size, const std::string& myfonts_id, RenderDone done) {
+    const auto finished = [done](Pipeline<ChannelCanvas>& p) {
+        ImageData img;
+        try {
+            img = p.result();
+        } catch (...) {
+            return done({}, std::current_exception());
         }
+        done(std::move(img), nullptr);
+    };
+    try {
+        start<ChannelCanvas>(shaper, font_size, myfonts_id, finished);
+    } catch (...) {
+        done({}, std::current_exception());
     }
-
-
-    return img_data;
 }
@@ -2,23 +2,42 @@
 
 #include "shaper.h"
 #include "common.h"
+#include "canvas.h"
 #include "owned_image.h"
 
 #include <cpr/cpr.h>
-#include <optional>
+#include <exception>
+#include <functional>
+#include <string>
+#include <vector>
 
-struct ClusterPair {
-    std::string text;
-    bool last;
-};
 
-struct Responses {
-    cpr::AsyncResponse first;
-    std::optional<cpr::AsyncResponse> second;
-};
+// Body of a successful response, or the error that ended the request
+using FetchDone = std::function<void(std::string body, std::exception_ptr error)>;
+
+// Fetches one render. done runs right away on a response cache hit, otherwise on a scheduler
+// thread once the request finished.
+void fetch(const std::string& url, const std::vector<cpr::Parameter>& params, FetchDone done);
+
+
+// The image of a finished render, or the error that ended it
+using RenderDone = std::function<void(ImageData image, std::exception_ptr error)>;
 
 
 class MyFonts {
 public:
+    // Base URL the font id is appended to, can point at a local stand-in server
+    static void set_endpoint(const std::string& url);
+    static std::string endpoint();
+
     static ImageData render_text(const Shaper& shaper, unsigned font_size, const std::string& myfonts_id);
+    static LabelData render_labels(const Shaper& shaper, unsigned font_size, const std::string& myfonts_id);
+    static ImageDims render_into(const Shaper& shaper, unsigned font_size, const std::string& myfonts_id, const ImageView& out);
+    // render_text at every size, shaping them in turn. All requests are in flight together.
+    static std::vector<ImageData> render_text_sizes(Shaper& shaper, const std::vector<unsigned>& font_sizes, const std::string& myfonts_id);
+
+    // render_text without waiting: returns once every request is sent and runs done exactly once,
+    // on a pool or scheduler thread when the image is ready, or right away when it fails early.
+    // Nothing of shaper is used after it returns. done must not throw.
+    static void render_text_async(const Shaper& shaper, unsigned font_size, const std::string& myfonts_id, RenderDone done);
 };
\ No newline at end of file
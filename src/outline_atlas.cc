@@ -0,0 +1,273 @@
+#include "outline_atlas.h"
+#include "file_util.h"
+#include "thread_pool.h"
+
+#include <fmt/format.h>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+
+#include FT_OUTLINE_H
+
+namespace fs = std::filesystem;
+
+
+// Header, glyph_count + 1 entries, the points at the next multiple of 8, then the verbs
+struct OutlineAtlas::Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t glyph_count;
+    uint64_t font_size;
+    uint64_t font_hash;
+    uint64_t verb_count;
+    uint64_t point_count;
+};
+
+// Where the outline of a glyph starts, the next entry is where it ends
+struct OutlineAtlas::Entry {
+    uint32_t verb;
+    uint32_t point;
+    uint32_t loaded;
+};
+
+
+namespace {
+
+constexpr char MAGIC[8] = {'T', 'O', 'U', 'T', 'L', 'I', 'N', 'E'};
+constexpr uint32_t VERSION = 1;
+
+using Header = OutlineAtlas::Header;
+using Entry = OutlineAtlas::Entry;
+
+size_t points_offset(const uint64_t glyph_count) {
+    const size_t end = sizeof(Header) + (glyph_count + 1) * sizeof(Entry);
+    return (end + 7) & ~size_t{7};
+}
+
+struct Decomposed {
+    std::vector<CommandType> verbs;
+    std::vector<OutlinePoint> points;
+    bool loaded = false;
+};
+
+int record(Decomposed& out, const CommandType type, std::initializer_list<const FT_Vector*> points) {
+    out.verbs.push_back(type);
+    for (const FT_Vector* v : points)
+        out.points.push_back({static_cast<int32_t>(v->x), static_cast<int32_t>(v->y)});
+    return 0;
+}
+
+constexpr FT_Outline_Funcs RECORD_CALLBACKS = {
+    [](const FT_Vector* to, void* user) {
+        return record(*static_cast<Decomposed*>(user), CommandType::MOVE, {to});
+    },
+    [](const FT_Vector* to, void* user) {
+        return record(*static_cast<Decomposed*>(user), CommandType::LINE, {to});
+    },
+    [](const FT_Vector* control, const FT_Vector* to, void* user) {
+        return record(*static_cast<Decomposed*>(user), CommandType::QUAD, {control, to});
+    },
+    [](const FT_Vector* control_one, const FT_Vector* control_two, const FT_Vector* to, void* user) {
+        return record(*static_cast<Decomposed*>(user), CommandType::CUBIC, {control_one, control_two, to});
+    },
+    0, 0
+};
+
+// FreeType faces are not thread safe, every pool slot decomposes with its own
+struct SlotFace {
+    FT_Library library = nullptr;
+    FT_Face face = nullptr;
+
+    ~SlotFace() {
+        if (face)
+            FT_Done_Face(face);
+        if (library)
+            FT_Done_FreeType(library);
+    }
+};
+
+}
+
+
+OutlineAtlas::OutlineAtlas(const std::string& path) {
+    try {
+        file = std::make_unique<MappedFile>(path);
+    } catch (const std::runtime_error&) {
+        throw std::runtime_error("Could not open outline atlas " + path);
+    }
+    const auto bad = [&] { return std::runtime_error("Invalid outline atlas " + path); };
+
+    if (file->size() < sizeof(Header))
+        throw bad();
+    header = reinterpret_cast<const Header*>(file->data());
+    if (std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version != VERSION)
+        throw bad();
+    const size_t points_at = points_offset(header->glyph_count);
+    const size_t verbs_at = points_at + header->point_count * sizeof(OutlinePoint);
+    if (file->size() < verbs_at || file->size() - verbs_at < header->verb_count)
+        throw bad();
+
+    entries = reinterpret_cast<const Entry*>(file->data() + sizeof(Header));
+    points = reinterpret_cast<const OutlinePoint*>(file->data() + points_at);
+    verbs = reinterpret_cast<const CommandType*>(file->data() + verbs_at);
+    const Entry& end = entries[header->glyph_count];
+    if (end.verb != header->verb_count || end.point != header->point_count)
+        throw bad();
+}
+
+uint32_t OutlineAtlas::glyph_count() const {
+    return header->glyph_count;
+}
+
+bool OutlineAtlas::matches(const MappedFile& font) const {
+    return header->font_size == font.size() && header->font_hash == fnv1a(font.data(), font.size());
+}
+
+GlyphOutline OutlineAtlas::glyph(const unsigned glyph_index) const {
+    if (glyph_index >= header->glyph_count || !entries[glyph_index].loaded)
+        throw std::runtime_error("Glyph didn't load, design pass");
+    const Entry& begin = entries[glyph_index];
+    const Entry& end = entries[glyph_index + 1];
+    if (end.verb < begin.verb || end.verb > header->verb_count || end.point > header->point_count)
+        throw std::runtime_error("Corrupt outline atlas entry");
+
+    // Outlines are used in place, so check that the verbs need exactly the points they own
+    uint32_t needed = 0;
+    for (uint32_t i = begin.verb; i < end.verb; ++i) {
+        const CommandType type = verbs[i];
+        if (type != CommandType::MOVE && type != CommandType::LINE && type != CommandType::QUAD && type != CommandType::CUBIC)
+            throw std::runtime_error("Corrupt outline atlas entry");
+        needed += point_count(type);
+    }
+    if (end.point < begin.point || end.point - begin.point != needed)
+        throw std::runtime_error("Corrupt outline atlas entry");
+    return {verbs + begin.verb, points + begin.point, end.verb - begin.verb, needed};
+}
+
+
+void OutlineAtlas::build(const FontId font, const std::string& path) {
+    const MappedFile& font_file = FontStore::shared().file(font);
+    ThreadPool& pool = ThreadPool::shared();
+    std::vector<SlotFace> slots(pool.size() + 1);
+
+    const auto open_face = [&](SlotFace& slot) {
+        if (FT_Init_FreeType(&slot.library))
+            throw std::runtime_error("Freetype library not init");
+        if (FT_New_Memory_Face(slot.library, font_file.data(), static_cast<FT_Long>(font_file.size()), 0, &slot.face))
+            throw std::runtime_error("Couldn't load FreeType font from data");
+        // Same size as Shaper::shape_design, where one pixel is one font unit
+        FT_Set_Char_Size(slot.face, 0, slot.face->units_per_EM * 64, 0, 72);
+    };
+    open_face(slots[0]);
+    const auto glyph_count = static_cast<uint32_t>(slots[0].face->num_glyphs);
+
+    std::vector<Decomposed> glyphs(glyph_count);
+    pool.parallel_for(glyph_count, 0, [&](const unsigned slot_index, const size_t i) {
+        SlotFace& slot = slots[slot_index];
+        if (!slot.face)
+            open_face(slot);
+        if (FT_Load_Glyph(slot.face, static_cast<FT_UInt>(i), FT_LOAD_NO_HINTING | FT_LOAD_NO_BITMAP))
+            return;
+        Decomposed& glyph = glyphs[i];
+        if (FT_Outline_Decompose(&slot.face->glyph->outline, &RECORD_CALLBACKS, &glyph)) {
+            glyph.verbs.clear();
+            glyph.points.clear();
+            return;
+        }
+        glyph.loaded = true;
+    });
+
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.glyph_count = glyph_count;
+    header.font_size = font_file.size();
+    header.font_hash = fnv1a(font_file.data(), font_file.size());
+    std::vector<Entry> entries;
+    entries.reserve(glyph_count + 1);
+    for (const Decomposed& glyph : glyphs) {
+        entries.push_back({static_cast<uint32_t>(header.verb_count), static_cast<uint32_t>(header.point_count), glyph.loaded});
+        header.verb_count += glyph.verbs.size();
+        header.point_count += glyph.points.size();
+    }
+    entries.push_back({static_cast<uint32_t>(header.verb_count), static_cast<uint32_t>(header.point_count), 0});
+
+    fs::path temp = path;
+    temp += temp_suffix();
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        const char padding[8] = {};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(entries.data()), static_cast<std::streamsize>(entries.size() * sizeof(Entry)));
+        out.write(padding, static_cast<std::streamsize>(points_offset(glyph_count) - sizeof(header) - entries.size() * sizeof(Entry)));
+        for (const Decomposed& glyph : glyphs)
+            out.write(reinterpret_cast<const char*>(glyph.points.data()), static_cast<std::streamsize>(glyph.points.size() * sizeof(OutlinePoint)));
+        for (const Decomposed& glyph : glyphs)
+            out.write(reinterpret_cast<const char*>(glyph.verbs.data()), static_cast<std::streamsize>(glyph.verbs.size()));
+        if (!out.flush()) {
+            out.close();
+            std::error_code ec;
+            fs::remove(temp, ec);
+            throw std::runtime_error("Could not write outline atlas " + path);
+        }
+    }
+    std::error_code ec;
+    fs::rename(temp, path, ec);
+    if (ec) {
+        fs::remove(temp, ec);
+        throw std::runtime_error(fmt::format("Could not write outline atlas {}: {}", path, ec.message()));
+    }
+}
+
+
+OutlineStore& OutlineStore::shared() {
+    static OutlineStore store;
+    return store;
+}
+
+void OutlineStore::attach(const FontId font, const std::string& path) {
+    auto atlas = std::make_shared<const OutlineAtlas>(path);
+    if (!atlas->matches(FontStore::shared().file(font)))
+        throw std::runtime_error(fmt::format("Outline atlas {} was built from another font than {}", path, FontStore::shared().path(font)));
+    std::unique_lock lock(mutex);
+    if (atlases.size() <= font)
+        atlases.resize(font + 1);
+    atlases[font] = std::move(atlas);
+}
+
+void OutlineStore::attach_dir(const FontId font, const std::string& directory) {
+    const std::string path = atlas_path(directory, FontStore::shared().path(font));
+    try {
+        attach(font, path);
+        return;
+    } catch (const std::runtime_error&) {
+        // Missing, unreadable or built from an older version of the font
+    }
+    std::error_code ec;
+    fs::create_directories(directory, ec);
+    if (ec)
+        throw std::runtime_error(fmt::format("Could not create outline atlas directory {}: {}", directory, ec.message()));
+    OutlineAtlas::build(font, path);
+    attach(font, path);
+}
+
+void OutlineStore::detach(const FontId font) {
+    std::unique_lock lock(mutex);
+    if (font < atlases.size())
+        atlases[font].reset();
+}
+
+std::shared_ptr<const OutlineAtlas> OutlineStore::find(const FontId font) const {
+    std::shared_lock lock(mutex);
+    return font < atlases.size() ? atlases[font] : nullptr;
+}
+
+
+std::string atlas_path(const std::string& directory, const std::string& font_path) {
+    return (fs::path(directory) / fs::path(font_path).filename()).string() + ".outlines";
+}
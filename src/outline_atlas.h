@@ -0,0 +1,64 @@
+#pragma once
+
+#include "font_store.h"
+#include "path.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+
+// Every glyph of a font decomposed once at its design size, indexed by glyph id. The file is
+// mapped read only and outlines are read in place, so like the fonts themselves an atlas is
+// loaded lazily and shared between every process that uses it.
+class OutlineAtlas {
+public:
+    explicit OutlineAtlas(const std::string& path);
+
+    // Decomposes the glyphs of a FontStore font on the shared pool and writes them to path,
+    // through a temporary file so readers never see a partial atlas
+    static void build(FontId font, const std::string& path);
+
+    // Throws like FreeType would for a glyph that didn't load when the atlas was built
+    GlyphOutline glyph(unsigned glyph_index) const;
+    uint32_t glyph_count() const;
+    // Whether the atlas was built from exactly this font file
+    bool matches(const MappedFile& font) const;
+
+    struct Header;
+    struct Entry;
+
+private:
+    std::unique_ptr<MappedFile> file;
+    const Header* header;
+    const Entry* entries;
+    const OutlinePoint* points;
+    const CommandType* verbs;
+};
+
+
+// Atlases by font. Shaper::path_data takes the outlines of a font with an atlas from there
+// instead of loading them through FreeType.
+class OutlineStore {
+public:
+    static OutlineStore& shared();
+
+    // Throws if the atlas was built from a different font file
+    void attach(FontId font, const std::string& path);
+    // Attaches atlas_path(directory, font), building it first when it is missing or stale
+    void attach_dir(FontId font, const std::string& directory);
+    void detach(FontId font);
+
+    std::shared_ptr<const OutlineAtlas> find(FontId font) const;
+
+private:
+    mutable std::shared_mutex mutex;
+    std::vector<std::shared_ptr<const OutlineAtlas>> atlases;
+};
+
+
+// The atlas of a font kept in directory: the font file name with .outlines appended
+std::string atlas_path(const std::string& directory, const std::string& font_path);
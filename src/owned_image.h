@@ -28,6 +28,18 @@ public:
         other.data = nullptr;
     }
 
+    OwnedImage& operator=(OwnedImage&& other) noexcept {
+        if (this != &other) {
+            if (data)
+                stbi_image_free(data);
+            data = other.data;
+            height = other.height;
+            width = other.width;
+            other.data = nullptr;
+        }
+        return *this;
+    }
+
     Eigen::TensorMap<ImageTensor> view() {
         return Eigen::TensorMap<ImageTensor>(data, height, width);
     }
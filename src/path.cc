@@ -2,9 +2,18 @@
 
 #include <limits>
 #include <algorithm>
+#include <iterator>
 #include <fmt/format.h>
 #include FT_OUTLINE_H
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PATH_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PATH_NEON
+#endif
+
 void Path::add(FT_Outline& outline, const Point& offset) {
     current_offset = offset;
     constexpr FT_Outline_Funcs callbacks = {move_to, line_to, quad_to, cubic_to, 0, 0};
@@ -12,164 +21,304 @@ void Path::add(FT_Outline& outline, const Point& offset) {
         throw std::runtime_error("Outline get fail");
 }
 
-std::string Path::string() const {
-    std::string pathstr;
-    if (path.empty())
-        return pathstr;
-    for (const auto& [type, to, control0, control1] : path) {
-        switch (type) {
-            case CommandType::MOVE: pathstr += fmt::format("M {} {} ", to.x, to.y); break;
-            case CommandType::LINE: pathstr += fmt::format("L {} {} ", to.x, to.y); break;
-            case CommandType::QUAD: pathstr += fmt::format("Q {} {} {} {} ", control0.x, control0.y, to.x, to.y); break;
-            case CommandType::CUBIC: pathstr += fmt::format("C {} {} {} {} {} {} ", control0.x, control0.y, control1.x, control1.y, to.x, to.y); break;
-            case CommandType::MOVE_REL: pathstr += fmt::format("m {} {} ", to.x, to.y); break;
-            case CommandType::LINE_REL: pathstr += fmt::format("l {} {} ", to.x, to.y); break;
-            case CommandType::QUAD_REL: pathstr += fmt::format("q {} {} {} {} ", control0.x, control0.y, to.x, to.y); break;
-            case CommandType::CUBIC_REL: pathstr += fmt::format("c {} {} {} {} {} {} ", control0.x, control0.y, control1.x, control1.y, to.x, to.y); break;
-            case CommandType::CLOSE: pathstr += "Z "; break;
+namespace {
+
+// Points are interleaved x, y floats, so a 128 bit vector holds two of them. Swapping the lanes
+// of each pair gives the y x order the off diagonal terms need.
+void transform_points(Point* points, const size_t n, const Matrix3& m) {
+    static_assert(sizeof(Point) == 2 * sizeof(float));
+    float* f = reinterpret_cast<float*>(points);
+    const bool affine = m[6] == 0 && m[7] == 0 && m[8] == 1;
+    size_t i = 0;
+#if defined(PATH_SSE2)
+    const __m128 diag = _mm_setr_ps(m[0], m[4], m[0], m[4]);
+    const __m128 cross = _mm_setr_ps(m[1], m[3], m[1], m[3]);
+    const __m128 shift = _mm_setr_ps(m[2], m[5], m[2], m[5]);
+    const __m128 persp = _mm_setr_ps(m[6], m[7], m[6], m[7]);
+    const __m128 w0 = _mm_set1_ps(m[8]);
+    for (; i + 2 <= n; i += 2) {
+        const __m128 v = _mm_loadu_ps(f + 2 * i);
+        const __m128 swapped = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+        __m128 out = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v, diag), _mm_mul_ps(swapped, cross)), shift);
+        if (!affine) {
+            const __m128 t = _mm_mul_ps(v, persp);
+            const __m128 w = _mm_add_ps(_mm_add_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 3, 0, 1))), w0);
+            out = _mm_div_ps(out, w);
+        }
+        _mm_storeu_ps(f + 2 * i, out);
+    }
+#elif defined(PATH_NEON)
+    const float32x4_t diag = {m[0], m[4], m[0], m[4]};
+    const float32x4_t cross = {m[1], m[3], m[1], m[3]};
+    const float32x4_t shift = {m[2], m[5], m[2], m[5]};
+    const float32x4_t persp = {m[6], m[7], m[6], m[7]};
+    const float32x4_t w0 = vdupq_n_f32(m[8]);
+    for (; i + 2 <= n; i += 2) {
+        const float32x4_t v = vld1q_f32(f + 2 * i);
+        float32x4_t out = vaddq_f32(vaddq_f32(vmulq_f32(v, diag), vmulq_f32(vrev64q_f32(v), cross)), shift);
+        if (!affine) {
+            const float32x4_t t = vmulq_f32(v, persp);
+            const float32x4_t w = vaddq_f32(vaddq_f32(t, vrev64q_f32(t)), w0);
+#if defined(__aarch64__)
+            out = vdivq_f32(out, w);
+#else
+            // ARMv7 has no vector divide, and its reciprocal estimate wouldn't round like the tail
+            float q[4], d[4];
+            vst1q_f32(q, out);
+            vst1q_f32(d, w);
+            for (int k = 0; k < 4; k++)
+                q[k] /= d[k];
+            out = vld1q_f32(q);
+#endif
+        }
+        vst1q_f32(f + 2 * i, out);
+    }
+#endif
+    // path.cc is built without floating point contraction, so this rounds like the lanes above
+    for (; i < n; ++i) {
+        const float x = points[i].x;
+        const float y = points[i].y;
+        float tx = m[0] * x + m[1] * y + m[2];
+        float ty = m[3] * x + m[4] * y + m[5];
+        if (!affine) {
+            const float w = m[6] * x + m[7] * y + m[8];
+            tx /= w;
+            ty /= w;
         }
+        points[i] = {tx, ty};
+    }
+}
+
+Command spell_out(const CommandType type, const Point* p) {
+    switch (point_count(type)) {
+        case 0: return Command(type);
+        case 1: return Command(type, p[0]);
+        case 2: return Command(type, p[1], p[0]);
+        default: return Command(type, p[2], p[0], p[1]);
+    }
+}
+
+}
+
+
+Path::Path(const std::vector<Command>& commands) {
+    verb_data.reserve(commands.size());
+    point_data.reserve(commands.size());
+    for (const auto& command : commands)
+        append(command);
+}
+
+void Path::append(const CommandType type, const Point* points) {
+    if (verb_data.empty() || is_move(type))
+        contour_data.push_back({static_cast<uint32_t>(verb_data.size()), static_cast<uint32_t>(point_data.size())});
+    verb_data.push_back(type);
+    point_data.insert(point_data.end(), points, points + point_count(type));
+}
+
+void Path::append(const Command& command) {
+    const Point quad[2] = {command.control0, command.to};
+    const Point cubic[3] = {command.control0, command.control1, command.to};
+    switch (point_count(command.type)) {
+        case 2: return append(command.type, quad);
+        case 3: return append(command.type, cubic);
+        default: return append(command.type, &command.to);
+    }
+}
+
+void Path::reserve(const size_t commands, const size_t points) {
+    verb_data.reserve(commands);
+    point_data.reserve(points);
+}
+
+std::vector<Command> Path::get_commands() const {
+    std::vector<Command> commands;
+    commands.reserve(verb_data.size());
+    const Point* p = point_data.data();
+    for (const CommandType type : verb_data) {
+        commands.push_back(spell_out(type, p));
+        p += point_count(type);
     }
-    pathstr.pop_back();
+    return commands;
+}
+
+
+namespace {
+
+constexpr char SVG_COMMANDS[] = {'M', 'm', 'L', 'l', 'Q', 'q', 'C', 'c', 'Z'};
+
+void put_number(std::string& out, const float v, const int precision) {
+    if (precision < 0) {
+        fmt::format_to(std::back_inserter(out), "{}", v);
+        return;
+    }
+    // Enough for any float with up to 9 digits after the point
+    char buffer[64];
+    char* end = fmt::format_to_n(buffer, sizeof(buffer), "{:.{}f}", v, std::min(precision, 9)).out;
+    if (precision > 0) {
+        while (end[-1] == '0')
+            --end;
+        if (end[-1] == '.')
+            --end;
+    }
+    if (end - buffer == 2 && buffer[0] == '-' && buffer[1] == '0')
+        out += '0';
+    else
+        out.append(buffer, end);
+}
+
+}
+
+
+void Path::write_svg(std::string& out, const int precision) const {
+    const Point* p = point_data.data();
+    for (size_t i = 0; i < verb_data.size(); ++i) {
+        const CommandType type = verb_data[i];
+        if (i > 0)
+            out += ' ';
+        out += SVG_COMMANDS[static_cast<uint8_t>(type)];
+        for (int k = 0; k < point_count(type); ++k) {
+            out += ' ';
+            put_number(out, p[k].x, precision);
+            out += ' ';
+            put_number(out, p[k].y, precision);
+        }
+        p += point_count(type);
+    }
+}
+
+std::string Path::string(const int precision) const {
+    std::string pathstr;
+    pathstr.reserve(verb_data.size() * 2 + point_data.size() * 16);
+    write_svg(pathstr, precision);
     return pathstr;
 }
 
+// Verbs and contours keep their places, only the points move relative to the previous end point
 Path Path::as_rel() const {
     Path rel_path;
+    rel_path.verb_data.reserve(verb_data.size());
+    rel_path.point_data.reserve(point_data.size());
+    rel_path.contour_data = contour_data;
 
     Point current_pos{};
     Point start_of_path{};
 
-    for (const auto& cmd : path) {
-        switch (cmd.type) {
+    const Point* p = point_data.data();
+    for (const CommandType type : verb_data) {
+        switch (type) {
             case CommandType::MOVE: {
-                Command rel_cmd(CommandType::MOVE_REL, cmd.to - current_pos);
-                rel_path.path.emplace_back(rel_cmd);
-                current_pos += rel_cmd.to;
+                const Point to = p[0] - current_pos;
+                rel_path.verb_data.push_back(CommandType::MOVE_REL);
+                rel_path.point_data.push_back(to);
+                current_pos += to;
                 start_of_path = current_pos;
                 break;
             }
             case CommandType::LINE: {
-                Command rel_cmd(CommandType::LINE_REL, cmd.to - current_pos);
-                rel_path.path.emplace_back(rel_cmd);
-                current_pos += rel_cmd.to;
+                const Point to = p[0] - current_pos;
+                rel_path.verb_data.push_back(CommandType::LINE_REL);
+                rel_path.point_data.push_back(to);
+                current_pos += to;
                 break;
             }
             case CommandType::QUAD: {
-                Command rel_cmd(CommandType::QUAD_REL, cmd.to - current_pos, cmd.control0 - current_pos);
-                rel_path.path.emplace_back(rel_cmd);
-                current_pos += rel_cmd.to;
+                const Point to = p[1] - current_pos;
+                rel_path.verb_data.push_back(CommandType::QUAD_REL);
+                rel_path.point_data.push_back(p[0] - current_pos);
+                rel_path.point_data.push_back(to);
+                current_pos += to;
                 break;
             }
             case CommandType::CUBIC: {
-                Command rel_cmd(CommandType::CUBIC_REL, cmd.to - current_pos, cmd.control0 - current_pos, cmd.control1 - current_pos);
-                rel_path.path.emplace_back(rel_cmd);
-                current_pos += rel_cmd.to;
+                const Point to = p[2] - current_pos;
+                rel_path.verb_data.push_back(CommandType::CUBIC_REL);
+                rel_path.point_data.push_back(p[0] - current_pos);
+                rel_path.point_data.push_back(p[1] - current_pos);
+                rel_path.point_data.push_back(to);
+                current_pos += to;
                 break;
             }
             case CommandType::CLOSE:
-                rel_path.path.push_back(cmd);
+                rel_path.verb_data.push_back(type);
                 current_pos = start_of_path;
                 break;
             default:
                 throw std::invalid_argument("rel called on relative path");
         }
-
+        p += point_count(type);
     }
 
     return rel_path;
 }
 
 Path& Path::to_cubic() {
+    const size_t quads = std::count_if(verb_data.begin(), verb_data.end(), [](const CommandType type) {
+        return type == CommandType::QUAD || type == CommandType::QUAD_REL;
+    });
+    if (quads == 0)
+        return *this;
+
+    // Every quad gains a point, so the points and the contour starts are rebuilt in one pass
+    std::vector<Point> cubic_points;
+    cubic_points.reserve(point_data.size() + quads);
+    auto contour = contour_data.begin();
     Point current_pos{};
-    for (auto& cmd : path) {
-        if (cmd.type == CommandType::QUAD || cmd.type == CommandType::QUAD_REL)
-            cmd = Command(
-                cmd.type == CommandType::QUAD ? CommandType::CUBIC : CommandType::CUBIC_REL,
-                cmd.to,
-                (current_pos + (cmd.control0 - current_pos) * (2.0 / 3.0)),
-                (cmd.to + (cmd.control0 - cmd.to) * (2.0 / 3.0))
-            );
-
-        if (cmd.type != CommandType::CLOSE)
-            current_pos = cmd.to;
+    const Point* p = point_data.data();
+    for (uint32_t i = 0; i < verb_data.size(); ++i) {
+        if (contour != contour_data.end() && contour->verb == i)
+            (contour++)->point = static_cast<uint32_t>(cubic_points.size());
+
+        CommandType& type = verb_data[i];
+        const int n = point_count(type);
+        if (type == CommandType::QUAD || type == CommandType::QUAD_REL) {
+            const Point control = p[0];
+            const Point to = p[1];
+            type = type == CommandType::QUAD ? CommandType::CUBIC : CommandType::CUBIC_REL;
+            cubic_points.push_back(current_pos + (control - current_pos) * (2.0 / 3.0));
+            cubic_points.push_back(to + (control - to) * (2.0 / 3.0));
+            cubic_points.push_back(to);
+        } else {
+            cubic_points.insert(cubic_points.end(), p, p + n);
+        }
+
+        if (type != CommandType::CLOSE)
+            current_pos = cubic_points.back();
+        p += n;
     }
+    point_data = std::move(cubic_points);
 
     return *this;
 }
 
 
 Path& Path::transform(const std::function<std::pair<float, float>(float, float)>& tr) {
-    auto tp = [&tr](Point& p) {
+    for (auto& p : point_data) {
         auto [x, y] = tr(p.x, p.y);
         p.x = x;
         p.y = y;
-    };
-    for (auto& cmd : path) {
-        switch (cmd.type) {
-            case CommandType::CLOSE:
-                break;
-            case CommandType::CUBIC:
-            case CommandType::CUBIC_REL:
-                tp(cmd.control1);
-            case CommandType::QUAD:
-            case CommandType::QUAD_REL:
-                tp(cmd.control0);
-            default:
-                tp(cmd.to);
-                break;
-        }
     }
     return *this;
 }
 
-
-
-inline std::vector<Command> make_clockwise(const std::vector<Command>& sub) {
-    std::vector<Command> new_path{sub[0]};
-    std::vector<Command> reversed(sub.begin() + 1, sub.end());
-    std::reverse(reversed.begin(), reversed.end());
-    for (int i = 0; i < reversed.size(); i++) {
-        const Command cmd = reversed[i];
-        Point where_we_were{};
-        if (i + 1 == reversed.size()) {
-            where_we_were = sub[0].to;
-        } else {
-            where_we_were = reversed[i + 1].to;
-        }
-
-        Command new_cmd(cmd.type, where_we_were);
-
-        switch (cmd.type) {
-            case CommandType::CUBIC:
-            case CommandType::CUBIC_REL:
-                new_cmd.control0 = cmd.control1;
-                new_cmd.control1 = cmd.control0;
-                break;
-            case CommandType::QUAD:
-            case CommandType::QUAD_REL:
-                throw std::invalid_argument("clockwise called on path with Q");
-            case CommandType::CLOSE:
-                throw std::invalid_argument("clockwise called on path with Z");
-            default:
-                break;
-        }
-        new_path.push_back(new_cmd);
-    }
-    return new_path;
+Path& Path::transform(const Matrix3& m) {
+    transform_points(point_data.data(), point_data.size(), m);
+    return *this;
 }
 
+void transform_paths(std::vector<Path>& paths, const Matrix3& m) {
+    for (auto& path : paths)
+        path.transform(m);
+}
 
-inline bool is_clockwise(const std::vector<Command>& cmds) {
-    float det = 0.0;
-    for (int i = 0; i < cmds.size() - 1; i++) {
-        if (cmds[i].type == CommandType::CLOSE)
-            throw std::invalid_argument("clockwise called on path with Z");
-        det += (cmds[i].to.x * cmds[i + 1].to.y) - (cmds[i].to.y * cmds[i + 1].to.x);
-    }
-    return det > 0.0;
+void transform_paths(std::vector<Path>& paths, const std::vector<Matrix3>& matrices) {
+    if (paths.size() != matrices.size())
+        throw std::invalid_argument("Need one matrix per path");
+    for (size_t i = 0; i < paths.size(); ++i)
+        paths[i].transform(matrices[i]);
 }
 
 
+
 inline bool is_top_left_of(const Point& a, const Point& b) {
     const float a_norm = a.x * a.x + a.y * a.y;
     const float b_norm = b.x * b.x + b.y * b.y;
@@ -177,96 +326,188 @@ inline bool is_top_left_of(const Point& a, const Point& b) {
 }
 
 
+namespace {
+
+// A contour as ranges of the path's verbs and points
+struct Placed {
+    uint32_t begin;
+    uint32_t end;
+    uint32_t point;
+    uint32_t point_end;
+    // Relative to begin, the top left command the contour now starts after, and where the points after it start
+    uint32_t leftest;
+    uint32_t split;
+    Point left;
+};
+
+// Kept per thread so reorder allocates nothing once these have grown to the largest path
+struct ReorderScratch {
+    std::vector<Placed> placed;
+    std::vector<CommandType> verbs;
+    std::vector<Point> points;
+};
+
+thread_local ReorderScratch scratch;
+
+// f(type, points) for every command of the contour after its move, in rotated order
+template<typename F>
+void for_rotated(const CommandType* verbs, const Point* points, const Placed& c, F&& f) {
+    const Point* p = points + c.split;
+    for (uint32_t i = c.begin + c.leftest + 1; i < c.end; p += point_count(verbs[i++]))
+        f(verbs[i], p);
+    p = points + c.point + 1;
+    for (uint32_t i = c.begin + 1; i <= c.begin + c.leftest; p += point_count(verbs[i++]))
+        f(verbs[i], p);
+}
+
+}
+
 
+// Every contour is rotated to start at its top left point, contours are sorted by that point
+// and all of them are flipped when the first one is not clockwise. Everything is checked
+// before the first write, so a path that throws is left as it was.
 Path& Path::reorder() {
-    std::vector<std::vector<Command>> separated;
-    std::vector<Command> current_path;
-    for (const auto& command : path) {
-        if (!current_path.empty() && command.type == CommandType::MOVE) {
-            separated.push_back(current_path);
-            current_path.clear();
-        }
-        current_path.push_back(command);
+    if (verb_data.empty())
+        return *this;
+
+    // Only the first contour can start with something other than a move. Its points are
+    // replaced by the move to the top left point, so make it a move that is never the top left.
+    if (point_count(verb_data.front()) != 1) {
+        const uint32_t n = point_count(verb_data.front());
+        Path normalized;
+        normalized.reserve(verb_data.size(), point_data.size() + 1);
+        normalized.current_offset = current_offset;
+        const Point far{std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
+        normalized.append(CommandType::MOVE, n ? &point_data[n - 1] : &far);
+        const Point* p = point_data.data() + n;
+        for (size_t i = 1; i < verb_data.size(); p += point_count(verb_data[i++]))
+            normalized.append(verb_data[i], p);
+        normalized.reorder();
+        *this = std::move(normalized);
+        return *this;
     }
-    if (!current_path.empty())
-        separated.push_back(current_path);
-
-    std::vector<std::pair<std::vector<Command>, Point>> reordered;
-    for (auto& sep : separated) {
-        Point left = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
-        int leftest_idx = -1;
-
-        for (int i = 0; i < sep.size(); i++) {
-            const Command& cmd = sep[i];
-            if (cmd.type != CommandType::CLOSE) {
-                if (is_top_left_of(cmd.to, left)) {
-                    left = cmd.to;
-                    leftest_idx = i;
-                }
+
+    CommandType* const verbs = verb_data.data();
+    Point* const points = point_data.data();
+
+    std::vector<Placed>& placed = scratch.placed;
+    placed.clear();
+    for (size_t c = 0; c < contour_data.size(); ++c) {
+        Placed contour{
+            contour_data[c].verb,
+            c + 1 < contour_data.size() ? contour_data[c + 1].verb : static_cast<uint32_t>(verb_data.size()),
+            contour_data[c].point,
+            0,
+            0,
+            contour_data[c].point + 1,
+            {std::numeric_limits<float>::max(), std::numeric_limits<float>::max()}
+        };
+        uint32_t at = contour.point;
+        for (uint32_t i = contour.begin; i < contour.end; ++i) {
+            const uint32_t n = point_count(verbs[i]);
+            if (verbs[i] != CommandType::CLOSE && is_top_left_of(points[at + n - 1], contour.left)) {
+                contour.left = points[at + n - 1];
+                contour.leftest = i - contour.begin;
+                contour.split = at + n;
             }
+            at += n;
         }
-
-        std::vector<Command> as_start_left{Command(CommandType::MOVE, left)};
-        as_start_left.insert(as_start_left.end(), sep.begin() + leftest_idx + 1, sep.end());
-        as_start_left.insert(as_start_left.end(), sep.begin() + 1, sep.begin() + leftest_idx + 1);
-
-        reordered.emplace_back(as_start_left, left);
+        contour.point_end = at;
+        placed.push_back(contour);
     }
 
-    std::sort(reordered.begin(), reordered.end(), [](const auto& a, const auto& b) {
-        if (a.second.y == b.second.y)
-            return a.second.x < b.second.x;
-        return a.second.y < b.second.y;
+    std::sort(placed.begin(), placed.end(), [](const Placed& a, const Placed& b) {
+        if (a.left.y == b.left.y)
+            return a.left.x < b.left.x;
+        return a.left.y < b.left.y;
     });
 
-    path.clear();
-
-    bool first_done = false;
     bool flip_cardinality = false;
-    for (auto& [cmds, _] : reordered) {
-        if (!first_done) {
-            flip_cardinality = !is_clockwise(cmds);
-            first_done = true;
-        }
+    {
+        const Placed& first = placed.front();
+        const uint32_t last = first.end - first.begin - 1;
+        float det = 0.0;
+        uint32_t k = 0;
+        Point a = first.left;
+        for_rotated(verbs, points, first, [&](const CommandType type, const Point* p) {
+            if (++k < last && type == CommandType::CLOSE)
+                throw std::invalid_argument("clockwise called on path with Z");
+            // A close ends where the command before it in the array ended
+            const Point b = p[static_cast<int>(point_count(type)) - 1];
+            det += (a.x * b.y) - (a.y * b.x);
+            a = b;
+        });
+        flip_cardinality = !(det > 0.0);
+    }
 
-        if (flip_cardinality)
-            cmds = make_clockwise(cmds);
+    if (flip_cardinality) {
+        // Same order the flipped commands are written in
+        for (const Placed& c : placed) {
+            const auto check = [&](const uint32_t i) {
+                if (verbs[i] == CommandType::QUAD || verbs[i] == CommandType::QUAD_REL)
+                    throw std::invalid_argument("clockwise called on path with Q");
+                if (verbs[i] == CommandType::CLOSE)
+                    throw std::invalid_argument("clockwise called on path with Z");
+            };
+            for (uint32_t i = c.begin + c.leftest; i > c.begin; --i)
+                check(i);
+            for (uint32_t i = c.end - 1; i > c.begin + c.leftest; --i)
+                check(i);
+        }
+    }
 
-        path.insert(path.end(), cmds.begin(), cmds.end());
+    for (const Placed& c : placed) {
+        verbs[c.begin] = CommandType::MOVE;
+        points[c.point] = c.left;
+        std::rotate(verbs + c.begin + 1, verbs + c.begin + c.leftest + 1, verbs + c.end);
+        std::rotate(points + c.point + 1, points + c.split, points + c.point_end);
+        if (!flip_cardinality || c.point_end == c.point + 1)
+            continue;
+
+        // Walked backwards, every command now ends where the one before it ended and a cubic's
+        // controls swap: reverse both, then shift the points by one so the contour ends at its start
+        std::reverse(verbs + c.begin + 1, verbs + c.end);
+        std::reverse(points + c.point + 1, points + c.point_end);
+        std::rotate(points + c.point + 1, points + c.point + 2, points + c.point_end);
+        points[c.point_end - 1] = c.left;
     }
 
+    const bool sorted = std::is_sorted(placed.begin(), placed.end(), [](const Placed& a, const Placed& b) {
+        return a.begin < b.begin;
+    });
+    if (!sorted) {
+        scratch.verbs.assign(verb_data.begin(), verb_data.end());
+        scratch.points.assign(point_data.begin(), point_data.end());
+        uint32_t verb = 0;
+        uint32_t point = 0;
+        for (size_t c = 0; c < placed.size(); ++c) {
+            const Placed& from = placed[c];
+            contour_data[c] = {verb, point};
+            std::copy(scratch.verbs.begin() + from.begin, scratch.verbs.begin() + from.end, verbs + verb);
+            std::copy(scratch.points.begin() + from.point, scratch.points.begin() + from.point_end, points + point);
+            verb += from.end - from.begin;
+            point += from.point_end - from.point;
+        }
+    }
 
     return *this;
 }
 
+void reorder_paths(std::vector<Path>& paths) {
+    for (auto& path : paths)
+        path.reorder();
+}
+
 
 std::pair<float, float> Path::lowest() const {
     float x_min = std::numeric_limits<float>::max();
     float y_min = std::numeric_limits<float>::max();
 
-    for (const auto& cmd : path) {
-        switch (cmd.type) {
-            case CommandType::CLOSE:
-                break;
-            case CommandType::CUBIC:
-            case CommandType::CUBIC_REL:
-                if (cmd.control1.x < x_min)
-                    x_min = cmd.control1.x;
-                if (cmd.control1.y < y_min)
-                    y_min = cmd.control1.y;
-            case CommandType::QUAD:
-            case CommandType::QUAD_REL:
-                if (cmd.control0.x < x_min)
-                    x_min = cmd.control0.x;
-                if (cmd.control0.y < y_min)
-                    y_min = cmd.control0.y;
-            default:
-                if (cmd.to.x < x_min)
-                    x_min = cmd.to.x;
-                if (cmd.to.y < y_min)
-                    y_min = cmd.to.y;
-                break;
-        }
+    for (const auto& p : point_data) {
+        if (p.x < x_min)
+            x_min = p.x;
+        if (p.y < y_min)
+            y_min = p.y;
     }
 
     return {x_min, y_min};
@@ -285,39 +526,87 @@ std::pair<float, float> Path::lowest() const {
 // -------------------------------------------------------------------------
 
 
+inline Point outline_point(const FT_Vector* v, const Point& offset) {
+    return Point{static_cast<float>(v->x) + offset.x, static_cast<float>(-v->y) - offset.y} / 64.0;
+}
+
+void Path::add(const GlyphOutline& outline, const Point& offset) {
+    current_offset = offset;
+    reserve(verb_data.size() + outline.verb_count, point_data.size() + outline.point_count);
+    const OutlinePoint* v = outline.points;
+    for (uint32_t i = 0; i < outline.verb_count; ++i) {
+        const CommandType type = outline.verbs[i];
+        Point p[3];
+        for (int k = 0; k < point_count(type); ++k, ++v) {
+            const FT_Vector vector{v->x, v->y};
+            p[k] = outline_point(&vector, offset);
+        }
+        append(type, p);
+    }
+}
+
 int Path::move_to(const FT_Vector* to, void* user) {
     const auto self = static_cast<Path*>(user);
-    self->path.emplace_back(
-        CommandType::MOVE,
-        Point{static_cast<float>(to->x) + self->current_offset.x, static_cast<float>(-to->y) - self->current_offset.y} / 64.0
-    );
+    const Point p = outline_point(to, self->current_offset);
+    self->append(CommandType::MOVE, &p);
     return 0;
 }
 int Path::line_to(const FT_Vector* to, void* user) {
     const auto self = static_cast<Path*>(user);
-    self->path.emplace_back(
-        CommandType::LINE,
-        Point{static_cast<float>(to->x) + self->current_offset.x, static_cast<float>(-to->y) - self->current_offset.y} / 64.0
-    );
+    const Point p = outline_point(to, self->current_offset);
+    self->append(CommandType::LINE, &p);
     return 0;
 }
 int Path::quad_to(const FT_Vector* control, const FT_Vector* to, void* user) {
     const auto self = static_cast<Path*>(user);
-    self->path.emplace_back(
-        CommandType::QUAD,
-        Point{static_cast<float>(to->x) + self->current_offset.x, static_cast<float>(-to->y) - self->current_offset.y} / 64.0,
-        Point{static_cast<float>(control->x) + self->current_offset.x, static_cast<float>(-control->y) - self->current_offset.y} / 64.0
-    );
+    const Point p[2] = {outline_point(control, self->current_offset), outline_point(to, self->current_offset)};
+    self->append(CommandType::QUAD, p);
     return 0;
 }
 int Path::cubic_to(const FT_Vector* control_one, const FT_Vector* control_two, const FT_Vector* to, void* user) {
     const auto self = static_cast<Path*>(user);
-    self->path.emplace_back(
-        CommandType::CUBIC,
-        Point{static_cast<float>(to->x) + self->current_offset.x, static_cast<float>(-to->y) - self->current_offset.y} / 64.0,
-        Point{static_cast<float>(control_one->x) + self->current_offset.x, static_cast<float>(-control_one->y) - self->current_offset.y} / 64.0,
-        Point{static_cast<float>(control_two->x) + self->current_offset.x, static_cast<float>(-control_two->y) - self->current_offset.y} / 64.0
-    );
+    const Point p[3] = {
+        outline_point(control_one, self->current_offset),
+        outline_point(control_two, self->current_offset),
+        outline_point(to, self->current_offset)
+    };
+    self->append(CommandType::CUBIC, p);
     return 0;
 }
 
+
+PathArrays pack_paths(const std::vector<const Path*>& paths) {
+    PathArrays out;
+    size_t verbs = 0;
+    size_t points = 0;
+    size_t contours = 0;
+    for (const Path* path : paths) {
+        verbs += path->verbs().size();
+        points += path->points().size();
+        contours += path->contours().size();
+    }
+    out.verbs.reserve(verbs);
+    out.points.reserve(points);
+    out.contours.reserve(contours);
+    out.paths.reserve(paths.size() + 1);
+
+    for (const Path* path : paths) {
+        const auto verb_offset = static_cast<uint32_t>(out.verbs.size());
+        const auto point_offset = static_cast<uint32_t>(out.points.size());
+        out.paths.push_back({verb_offset, point_offset, static_cast<uint32_t>(out.contours.size())});
+        out.verbs.insert(out.verbs.end(), path->verbs().begin(), path->verbs().end());
+        out.points.insert(out.points.end(), path->points().begin(), path->points().end());
+        for (const Contour& c : path->contours())
+            out.contours.push_back({c.verb + verb_offset, c.point + point_offset});
+    }
+    out.paths.push_back({static_cast<uint32_t>(out.verbs.size()), static_cast<uint32_t>(out.points.size()), static_cast<uint32_t>(out.contours.size())});
+    return out;
+}
+
+PathArrays pack_paths(const std::vector<Path>& paths) {
+    std::vector<const Path*> pointers;
+    pointers.reserve(paths.size());
+    for (const auto& path : paths)
+        pointers.push_back(&path);
+    return pack_paths(pointers);
+}
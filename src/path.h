@@ -1,5 +1,7 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
 #include <utility>
 #include <string>
 #include <ft2build.h>
@@ -31,7 +33,29 @@ struct Point {
 };
 
 
-enum class CommandType { MOVE, MOVE_REL, LINE, LINE_REL, QUAD, QUAD_REL, CUBIC, CUBIC_REL, CLOSE };
+enum class CommandType : uint8_t { MOVE, MOVE_REL, LINE, LINE_REL, QUAD, QUAD_REL, CUBIC, CUBIC_REL, CLOSE };
+
+// Points a command keeps in the point array, control points first and then the end point
+constexpr int point_count(const CommandType type) {
+    switch (type) {
+        case CommandType::QUAD:
+        case CommandType::QUAD_REL:
+            return 2;
+        case CommandType::CUBIC:
+        case CommandType::CUBIC_REL:
+            return 3;
+        case CommandType::CLOSE:
+            return 0;
+        default:
+            return 1;
+    }
+}
+
+constexpr bool is_move(const CommandType type) {
+    return type == CommandType::MOVE || type == CommandType::MOVE_REL;
+}
+
+// One command with all its points spelled out, only used to build and inspect paths
 struct Command {
     CommandType type;
     Point to;
@@ -42,21 +66,71 @@ struct Command {
         : type(type), to(to), control0(control0), control1(control1) {}
 };
 
+// Row major, applied to (x, y, 1). Points are divided by w unless the last row is 0 0 1.
+using Matrix3 = std::array<float, 9>;
+
+
+// Where a contour starts in the verb and the point array
+struct Contour {
+    uint32_t verb;
+    uint32_t point;
+};
+
+
+// A glyph outline the way FT_Outline_Decompose reports it for the unhinted glyph at its design
+// size: moves, lines, quads and cubics over raw 26.6 coordinates
+struct OutlinePoint {
+    int32_t x;
+    int32_t y;
+};
+
+struct GlyphOutline {
+    const CommandType* verbs;
+    const OutlinePoint* points;
+    uint32_t verb_count;
+    uint32_t point_count;
+};
+
+
+// Stored as a structure of arrays: one byte per command, only the points a command uses and
+// the start of every contour. A contour begins at every move and at the first command.
 class Path {
 public:
+    Path() = default;
+    explicit Path(const std::vector<Command>& commands);
 
     void add(FT_Outline& outline, const Point& offset);
-    std::string string() const;
-    const std::vector<Command>& get_commands() const { return path; }
+    // Same commands as adding the FT_Outline the glyph was decomposed from
+    void add(const GlyphOutline& outline, const Point& offset);
+    void append(const Command& command);
+    void append(CommandType type, const Point* points);
+    void reserve(size_t commands, size_t points);
+
+    // SVG path data. precision is the number of digits after the point with trailing zeros
+    // dropped, a negative one writes the shortest form that reads back to the same float.
+    std::string string(int precision = -1) const;
+    // Appends the same to out, so many paths can share one buffer
+    void write_svg(std::string& out, int precision = -1) const;
+    // Spelled out copy of the commands
+    std::vector<Command> get_commands() const;
+
+    const std::vector<CommandType>& verbs() const { return verb_data; }
+    const std::vector<Point>& points() const { return point_data; }
+    const std::vector<Contour>& contours() const { return contour_data; }
+    size_t size() const { return verb_data.size(); }
+    bool empty() const { return verb_data.empty(); }
 
     std::pair<float, float> lowest() const;
 
     Path as_rel() const;
     Path& to_cubic();
     Path& transform(const std::function<std::pair<float, float>(float, float)>& tr);
+    Path& transform(const Matrix3& m);
     Path& reorder();
 private:
-    std::vector<Command> path;
+    std::vector<CommandType> verb_data;
+    std::vector<Point> point_data;
+    std::vector<Contour> contour_data;
     Point current_offset{};
 
     static int move_to(const FT_Vector* to, void* user);
@@ -64,3 +138,28 @@ private:
     static int quad_to(const FT_Vector* control, const FT_Vector* to, void* user);
     static int cubic_to(const FT_Vector* control_one, const FT_Vector* control_two, const FT_Vector* to, void* user);
 };
+
+
+// Outlines of every cluster, each starting at the origin, and the advances between them
+using TextPaths = std::pair<std::vector<Path>, std::vector<float>>;
+
+
+// One matrix for every path, or matrices[i] for paths[i]
+void transform_paths(std::vector<Path>& paths, const Matrix3& m);
+void transform_paths(std::vector<Path>& paths, const std::vector<Matrix3>& matrices);
+// Path::reorder on every path, e.g. all of a text_paths result
+void reorder_paths(std::vector<Path>& paths);
+
+
+// Paths of one text concatenated into flat arrays
+struct PathArrays {
+    std::vector<CommandType> verbs;
+    std::vector<Point> points;
+    // Contour starts, offsets into the concatenated verbs and points
+    std::vector<Contour> contours;
+    // Verb, point and contour offset where path i starts, one more row marks the end
+    std::vector<std::array<uint32_t, 3>> paths;
+};
+
+PathArrays pack_paths(const std::vector<const Path*>& paths);
+PathArrays pack_paths(const std::vector<Path>& paths);
@@ -0,0 +1,396 @@
+#include "raster.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RASTER_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RASTER_NEON
+#endif
+
+
+namespace {
+
+// Largest distance between a curve and the lines it is flattened into, in pixels
+constexpr float TOLERANCE = 0.1f;
+constexpr int MAX_SEGMENTS = 256;
+// Anything larger is a transform gone wrong rather than text
+constexpr Eigen::Index MAX_CANVAS_BYTES = Eigen::Index{1} << 28;
+constexpr float MAX_COORDINATE = 1 << 24;
+
+
+struct Edge {
+    Point p0;
+    Point p1;
+};
+
+// Edges [begin, end) of the shared edge list and their bounds, in pixels
+struct Cluster {
+    size_t begin;
+    size_t end;
+    int x_min;
+    int x_max;
+    int y_min;
+    int y_max;
+};
+
+
+class Mapper {
+public:
+    explicit Mapper(const Matrix3& m) : m(m), affine(m[6] == 0 && m[7] == 0 && m[8] == 1) {}
+
+    Point operator()(const Point& p) const {
+        const float x = m[0] * p.x + m[1] * p.y + m[2];
+        const float y = m[3] * p.x + m[4] * p.y + m[5];
+        if (affine)
+            return {x, y};
+        const float w = m[6] * p.x + m[7] * p.y + m[8];
+        return {x / w, y / w};
+    }
+
+private:
+    Matrix3 m;
+    bool affine;
+};
+
+
+// Enough segments to keep a curve with this second difference within TOLERANCE
+int segments(const float second_difference, const float factor) {
+    const float n = std::ceil(std::sqrt(second_difference * factor / TOLERANCE));
+    if (!(n > 1))
+        return 1;
+    return n < MAX_SEGMENTS ? static_cast<int>(n) : MAX_SEGMENTS;
+}
+
+float length(const Point& p) {
+    return std::sqrt(p.x * p.x + p.y * p.y);
+}
+
+// Appends the edges of path moved by offset and mapped into pixels, every contour closed
+void flatten(const Path& path, const Point& offset, const Mapper& map, std::vector<Edge>& edges) {
+    // Design space, relative commands are relative to current
+    Point current{};
+    Point start{};
+    // Pixels
+    Point at{};
+    Point first{};
+    bool open = false;
+
+    const auto line_to = [&](const Point& p) {
+        if (std::isfinite(at.x) && std::isfinite(at.y) && std::isfinite(p.x) && std::isfinite(p.y))
+            edges.push_back({at, p});
+        at = p;
+    };
+    const auto begin = [&] {
+        if (!open) {
+            first = at = map(current + offset);
+            open = true;
+        }
+    };
+    const auto close = [&] {
+        if (open && (at.x != first.x || at.y != first.y))
+            line_to(first);
+        open = false;
+        at = first;
+    };
+
+    const Point* p = path.points().data();
+    for (const CommandType type : path.verbs()) {
+        const int n = point_count(type);
+        const bool relative = type == CommandType::MOVE_REL || type == CommandType::LINE_REL
+            || type == CommandType::QUAD_REL || type == CommandType::CUBIC_REL;
+        Point q[3];
+        for (int k = 0; k < n; ++k)
+            q[k] = relative ? p[k] + current : p[k];
+
+        switch (type) {
+            case CommandType::MOVE:
+            case CommandType::MOVE_REL:
+                close();
+                start = current = q[0];
+                begin();
+                break;
+            case CommandType::LINE:
+            case CommandType::LINE_REL:
+                begin();
+                line_to(map(q[0] + offset));
+                current = q[0];
+                break;
+            case CommandType::QUAD:
+            case CommandType::QUAD_REL: {
+                begin();
+                const Point p0 = at;
+                const Point p1 = map(q[0] + offset);
+                const Point p2 = map(q[1] + offset);
+                const int count = segments(length(p0 - p1 * 2 + p2), 0.25f);
+                for (int i = 1; i < count; ++i) {
+                    const float t = static_cast<float>(i) / static_cast<float>(count);
+                    const float u = 1 - t;
+                    line_to(p0 * (u * u) + p1 * (2 * u * t) + p2 * (t * t));
+                }
+                line_to(p2);
+                current = q[1];
+                break;
+            }
+            case CommandType::CUBIC:
+            case CommandType::CUBIC_REL: {
+                begin();
+                const Point p0 = at;
+                const Point p1 = map(q[0] + offset);
+                const Point p2 = map(q[1] + offset);
+                const Point p3 = map(q[2] + offset);
+                const int count = segments(std::max(length(p0 - p1 * 2 + p2), length(p1 - p2 * 2 + p3)), 0.75f);
+                for (int i = 1; i < count; ++i) {
+                    const float t = static_cast<float>(i) / static_cast<float>(count);
+                    const float u = 1 - t;
+                    line_to(p0 * (u * u * u) + p1 * (3 * u * u * t) + p2 * (3 * u * t * t) + p3 * (t * t * t));
+                }
+                line_to(p3);
+                current = q[2];
+                break;
+            }
+            case CommandType::CLOSE:
+                close();
+                current = start;
+                break;
+        }
+        p += n;
+    }
+    close();
+}
+
+
+// Adds the signed area edge covers in every pixel to the right of it, rows are stride apart.
+// A prefix sum over a row then gives the winding weighted coverage of each pixel.
+void accumulate_edge(float* acc, const size_t stride, const float width, const int height, Point p0, Point p1) {
+    if (p0.y == p1.y)
+        return;
+    float dir = 1;
+    if (p0.y > p1.y) {
+        std::swap(p0, p1);
+        dir = -1;
+    }
+    const float dxdy = (p1.x - p0.x) / (p1.y - p0.y);
+    float x = p0.x;
+    const int y_begin = std::max(0, static_cast<int>(p0.y));
+    if (p0.y < 0)
+        x -= p0.y * dxdy;
+    const int y_end = std::min(height, static_cast<int>(std::ceil(p1.y)));
+
+    for (int y = y_begin; y < y_end; ++y) {
+        float* row = acc + static_cast<size_t>(y) * stride;
+        const float dy = std::min(static_cast<float>(y + 1), p1.y) - std::max(static_cast<float>(y), p0.y);
+        const float x_next = x + dxdy * dy;
+        const float d = dy * dir;
+        // Rounding can step a hair outside the box
+        const float xa = std::clamp(x, 0.0f, width);
+        const float xb = std::clamp(x_next, 0.0f, width);
+        const float x0 = std::min(xa, xb);
+        const float x1 = std::max(xa, xb);
+        const float x0_floor = std::floor(x0);
+        const auto x0i = static_cast<int>(x0_floor);
+        const float x1_ceil = std::ceil(x1);
+        const auto x1i = static_cast<int>(x1_ceil);
+
+        if (x1i <= x0i + 1) {
+            // Within one pixel, the area right of the edge in it splits by its mean x
+            const float xm = 0.5f * (xa + xb) - x0_floor;
+            row[x0i] += d - d * xm;
+            row[x0i + 1] += d * xm;
+        } else {
+            const float s = 1.0f / (x1 - x0);
+            const float x0f = x0 - x0_floor;
+            const float a0 = 0.5f * s * (1.0f - x0f) * (1.0f - x0f);
+            const float x1f = x1 - x1_ceil + 1.0f;
+            const float am = 0.5f * s * x1f * x1f;
+            row[x0i] += d * a0;
+            if (x1i == x0i + 2) {
+                row[x0i + 1] += d * (1.0f - a0 - am);
+            } else {
+                const float a1 = s * (1.5f - x0f);
+                row[x0i + 1] += d * (a1 - a0);
+                for (int xi = x0i + 2; xi < x1i - 1; ++xi)
+                    row[xi] += d * s;
+                const float a2 = a1 + static_cast<float>(x1i - x0i - 3) * s;
+                row[x1i - 1] += d * (1.0f - a2 - am);
+            }
+            row[x1i] += d * am;
+        }
+        x = x_next;
+    }
+}
+
+
+// Prefix sums a row of accumulated area into 0-255 coverage, |winding| clamped to 1 being the
+// nonzero rule
+void coverage_row(const float* acc, uint8_t* out, const int width) {
+    int x = 0;
+    float sum = 0;
+#if defined(RASTER_SSE2)
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(255.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    __m128 carry = _mm_setzero_ps();
+    for (; x + 4 <= width; x += 4) {
+        __m128 v = _mm_loadu_ps(acc + x);
+        v = _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 4)));
+        v = _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 8)));
+        v = _mm_add_ps(v, carry);
+        carry = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+        const __m128 c = _mm_min_ps(_mm_andnot_ps(sign, v), one);
+        __m128i i = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, scale), half));
+        i = _mm_packs_epi32(i, i);
+        i = _mm_packus_epi16(i, i);
+        const int packed = _mm_cvtsi128_si32(i);
+        std::memcpy(out + x, &packed, sizeof(packed));
+    }
+    sum = _mm_cvtss_f32(carry);
+#elif defined(RASTER_NEON)
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const float32x4_t scale = vdupq_n_f32(255.0f);
+    const float32x4_t half = vdupq_n_f32(0.5f);
+    float32x4_t carry = zero;
+    for (; x + 4 <= width; x += 4) {
+        float32x4_t v = vld1q_f32(acc + x);
+        v = vaddq_f32(v, vextq_f32(zero, v, 3));
+        v = vaddq_f32(v, vextq_f32(zero, v, 2));
+        v = vaddq_f32(v, carry);
+        carry = vdupq_n_f32(vgetq_lane_f32(v, 3));
+        const float32x4_t c = vminq_f32(vabsq_f32(v), one);
+        const uint16x4_t i16 = vmovn_u32(vcvtq_u32_f32(vaddq_f32(vmulq_f32(c, scale), half)));
+        const uint8x8_t i8 = vmovn_u16(vcombine_u16(i16, i16));
+        const uint32_t packed = vget_lane_u32(vreinterpret_u32_u8(i8), 0);
+        std::memcpy(out + x, &packed, sizeof(packed));
+    }
+    sum = vgetq_lane_f32(carry, 0);
+#endif
+    for (; x < width; ++x) {
+        sum += acc[x];
+        out[x] = static_cast<uint8_t>(std::min(std::fabs(sum), 1.0f) * 255.0f + 0.5f);
+    }
+}
+
+
+// Kept per thread, so rasterizing allocates nothing once these have grown
+struct RasterScratch {
+    std::vector<Edge> edges;
+    std::vector<Cluster> clusters;
+    std::vector<float> acc;
+    std::vector<uint8_t> coverage;
+};
+
+thread_local RasterScratch scratch;
+
+
+template<typename Canvas, typename... Args>
+typename Canvas::Output render(const TextPaths& text, const Matrix3& transform, Args&&... args) {
+    const StageTimer timer(Stage::RASTER);
+    const auto& [paths, advances] = text;
+    if (!paths.empty() && advances.size() + 1 != paths.size())
+        throw std::invalid_argument("Need one advance between every two paths");
+    Stats::add(Tally::CLUSTERS, paths.size());
+
+    const Mapper map(transform);
+    std::vector<Edge>& edges = scratch.edges;
+    std::vector<Cluster>& clusters = scratch.clusters;
+    edges.clear();
+    clusters.clear();
+
+    TextBox ink{std::numeric_limits<int>::max(), std::numeric_limits<int>::min(), std::numeric_limits<int>::max(), std::numeric_limits<int>::min()};
+    Point offset{};
+    for (size_t i = 0; i < paths.size(); ++i) {
+        Cluster cluster{edges.size(), 0, 0, 0, 0, 0};
+        flatten(paths[i], offset, map, edges);
+        if (i < advances.size())
+            offset.x += advances[i];
+        cluster.end = edges.size();
+
+        float x_min = std::numeric_limits<float>::max();
+        float x_max = std::numeric_limits<float>::lowest();
+        float y_min = std::numeric_limits<float>::max();
+        float y_max = std::numeric_limits<float>::lowest();
+        for (size_t e = cluster.begin; e < cluster.end; ++e) {
+            x_min = std::min({x_min, edges[e].p0.x, edges[e].p1.x});
+            x_max = std::max({x_max, edges[e].p0.x, edges[e].p1.x});
+            y_min = std::min({y_min, edges[e].p0.y, edges[e].p1.y});
+            y_max = std::max({y_max, edges[e].p0.y, edges[e].p1.y});
+        }
+        if (cluster.end > cluster.begin && y_max > y_min) {
+            if (std::max({-x_min, x_max, -y_min, y_max}) > MAX_COORDINATE)
+                throw std::invalid_argument("Transformed text is too large to rasterize");
+            cluster.x_min = static_cast<int>(std::floor(x_min));
+            cluster.x_max = static_cast<int>(std::ceil(x_max));
+            cluster.y_min = static_cast<int>(std::floor(y_min));
+            cluster.y_max = static_cast<int>(std::ceil(y_max));
+            ink.x_min = std::min(ink.x_min, cluster.x_min);
+            ink.x_max = std::max(ink.x_max, cluster.x_max);
+            ink.y_min = std::min(ink.y_min, cluster.y_min);
+            ink.y_max = std::max(ink.y_max, cluster.y_max);
+        } else {
+            cluster.end = cluster.begin;
+        }
+        clusters.push_back(cluster);
+    }
+    if (ink.x_max < ink.x_min)
+        ink = {};
+
+    const auto h = static_cast<Eigen::Index>(ink.y_max) - ink.y_min;
+    const auto w = static_cast<Eigen::Index>(ink.x_max) - ink.x_min;
+    // h * w first, so that the per canvas size can't overflow
+    if (h * w > MAX_CANVAS_BYTES || Canvas::bytes(static_cast<Eigen::Index>(clusters.size()), h, w) > MAX_CANVAS_BYTES)
+        throw std::invalid_argument("Transformed text is too large to rasterize");
+    Canvas img(std::forward<Args>(args)..., static_cast<Eigen::Index>(clusters.size()), h, w);
+
+    img.fill_image(255);
+
+    for (unsigned i = 0; i < clusters.size(); i++) {
+        const Cluster& cluster = clusters[i];
+        if (cluster.end == cluster.begin)
+            continue;
+        const int cw = cluster.x_max - cluster.x_min;
+        const int ch = cluster.y_max - cluster.y_min;
+        const size_t stride = static_cast<size_t>(cw) + 2;
+        scratch.acc.assign(stride * static_cast<size_t>(ch), 0.0f);
+        scratch.coverage.resize(static_cast<size_t>(cw));
+
+        const Point origin{static_cast<float>(cluster.x_min), static_cast<float>(cluster.y_min)};
+        for (size_t e = cluster.begin; e < cluster.end; ++e)
+            accumulate_edge(scratch.acc.data(), stride, static_cast<float>(cw), ch, edges[e].p0 - origin, edges[e].p1 - origin);
+
+        const int pos_x = cluster.x_min - ink.x_min;
+        const int pos_y = cluster.y_min - ink.y_min;
+        for (int row = 0; row < ch; ++row) {
+            coverage_row(scratch.acc.data() + static_cast<size_t>(row) * stride, scratch.coverage.data(), cw);
+            img.composite_row(i, pos_y + row, pos_x, scratch.coverage.data(), cw);
+        }
+    }
+
+    return img.finish();
+}
+
+}
+
+
+ImageData Rasterizer::render_text(const TextPaths& text, const Matrix3& transform) {
+    return render<ChannelCanvas>(text, transform);
+}
+
+LabelData Rasterizer::render_labels(const TextPaths& text, const Matrix3& transform) {
+    return render<LabelCanvas>(text, transform);
+}
+
+ImageDims Rasterizer::render_into(const TextPaths& text, const Matrix3& transform, const ImageView& out) {
+    return render<ViewCanvas>(text, transform, out);
+}
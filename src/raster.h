@@ -0,0 +1,20 @@
+#pragma once
+
+#include "canvas.h"
+#include "common.h"
+#include "path.h"
+
+#include <vector>
+
+
+// Scanline rasterizer for text FreeType can't render, such as rotated, sheared or perspective
+// text. Each path is one cluster, moved right by the advances before it. Its points then go
+// through transform into pixels with y down, and the outline is flattened and filled with the
+// nonzero rule by accumulating signed area coverage. The output layout matches Freetype's:
+// cropped to the ink, black on white, plus one mask per cluster.
+class Rasterizer {
+public:
+    static ImageData render_text(const TextPaths& text, const Matrix3& transform);
+    static LabelData render_labels(const TextPaths& text, const Matrix3& transform);
+    static ImageDims render_into(const TextPaths& text, const Matrix3& transform, const ImageView& out);
+};
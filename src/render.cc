@@ -1,22 +1,10 @@
 #include "render.h"
+#include "stats.h"
+#include "thread_pool.h"
 
-#include <fstream>
 #include <optional>
-
-void Renderer::set_font(const std::string& font_path) {
-    shaper.done_font();
-
-    std::ifstream font(font_path, std::ios::binary);
-    if (!font.is_open())
-        throw std::runtime_error("Invalid font: " + font_path);
-    font_data.assign(
-        (std::istreambuf_iterator<char>(font)),
-        (std::istreambuf_iterator<char>())
-    );
-    font.close();
-
-    shaper.set_font(font_data);
-}
+#include <stdexcept>
+#include <tuple>
 
 void Renderer::set_mode(RenderMode mode, std::optional<std::string> myfonts_id) {
     this->mode = mode;
@@ -38,6 +26,8 @@ TextPaths Renderer::text_paths() {
 }
 
 ImageData Renderer::render_text(const unsigned font_size) {
+    const StageTimer timer(Stage::RENDER);
+    Stats::add(Tally::RENDERS);
     ImageData img;
     shaper.shape(font_size);
     switch (mode) {
@@ -52,3 +42,165 @@ ImageData Renderer::render_text(const unsigned font_size) {
     }
     return img;
 }
+
+void Renderer::render_text_async(const unsigned font_size, RenderDone done) {
+    if (mode != RenderMode::MYFONTS) {
+        ImageData img;
+        try {
+            img = render_text(font_size);
+        } catch (...) {
+            return done({}, std::current_exception());
+        }
+        return done(std::move(img), nullptr);
+    }
+
+    const StageTimer timer(Stage::RENDER);
+    Stats::add(Tally::RENDERS);
+    try {
+        shaper.shape(font_size);
+    } catch (...) {
+        return done({}, std::current_exception());
+    }
+    MyFonts::render_text_async(shaper, font_size, *myfonts_id, std::move(done));
+}
+
+std::vector<ImageData> Renderer::render_text_sizes(const std::vector<unsigned>& font_sizes) {
+    const StageTimer timer(Stage::RENDER);
+    Stats::add(Tally::RENDERS, font_sizes.size());
+    switch (mode) {
+        case RenderMode::FREETYPE: {
+            std::vector<ImageData> images;
+            images.reserve(font_sizes.size());
+            for (const unsigned font_size : font_sizes) {
+                shaper.shape(font_size);
+                images.push_back(Freetype::render_text(shaper));
+            }
+            return images;
+        }
+        case RenderMode::MYFONTS:
+            return MyFonts::render_text_sizes(shaper, font_sizes, *myfonts_id);
+        default:
+            throw std::runtime_error("Shielded by Python");
+    }
+}
+
+LabelData Renderer::render_labels(const unsigned font_size) {
+    const StageTimer timer(Stage::RENDER);
+    Stats::add(Tally::RENDERS);
+    shaper.shape(font_size);
+    switch (mode) {
+        case RenderMode::FREETYPE:
+            return Freetype::render_labels(shaper);
+        case RenderMode::MYFONTS:
+            return MyFonts::render_labels(shaper, font_size, *myfonts_id);
+        default:
+            throw std::runtime_error("Shielded by Python");
+    }
+}
+
+ImageDims Renderer::render_into(const unsigned font_size, const ImageView& out) {
+    const StageTimer timer(Stage::RENDER);
+    Stats::add(Tally::RENDERS);
+    shaper.shape(font_size);
+    switch (mode) {
+        case RenderMode::FREETYPE:
+            return Freetype::render_into(shaper, out);
+        case RenderMode::MYFONTS:
+            return MyFonts::render_into(shaper, font_size, *myfonts_id, out);
+        default:
+            throw std::runtime_error("Shielded by Python");
+    }
+}
+
+
+Matrix3 Renderer::design_to_pixels(const unsigned font_size, const Matrix3& transform) const {
+    const float scale = static_cast<float>(font_size * shaper.get_params().dpi)
+        / (72.0f * static_cast<float>(shaper.get_ft_face()->units_per_EM));
+    Matrix3 m = transform;
+    for (int row = 0; row < 3; ++row) {
+        m[row * 3] *= scale;
+        m[row * 3 + 1] *= scale;
+    }
+    return m;
+}
+
+ImageData Renderer::render_transformed(const unsigned font_size, const Matrix3& transform) {
+    const StageTimer timer(Stage::RENDER);
+    Stats::add(Tally::RENDERS);
+    const TextPaths text = text_paths();
+    return Rasterizer::render_text(text, design_to_pixels(font_size, transform));
+}
+
+LabelData Renderer::render_transformed_labels(const unsigned font_size, const Matrix3& transform) {
+    const StageTimer timer(Stage::RENDER);
+    Stats::add(Tally::RENDERS);
+    const TextPaths text = text_paths();
+    return Rasterizer::render_labels(text, design_to_pixels(font_size, transform));
+}
+
+
+void Renderer::for_batch(
+            const std::vector<std::string>& texts,
+            const std::vector<unsigned>& sizes,
+            const std::vector<std::string>& fonts,
+            const std::function<void(Renderer&, size_t)>& fn
+        ) {
+    if (texts.size() != sizes.size() || texts.size() != fonts.size())
+        throw std::invalid_argument("texts, sizes and fonts must have the same length");
+
+    std::lock_guard lock(batch_mutex);
+    ThreadPool& pool = ThreadPool::shared();
+    while (batch_workers.size() < pool.size() + 1)
+        batch_workers.emplace_back(std::make_unique<Renderer>());
+    for (const auto& worker : batch_workers)
+        worker->set_mode(mode, myfonts_id);
+
+    std::vector<FontId> font_ids;
+    font_ids.reserve(fonts.size());
+    for (const auto& font : fonts)
+        font_ids.push_back(FontStore::shared().add(font));
+
+    pool.parallel_for(texts.size(), static_cast<unsigned>(batch_workers.size()), [&](const unsigned slot, const size_t i) {
+        Renderer& worker = *batch_workers[slot];
+        worker.set_font_id(font_ids[i]);
+        worker.set_text(texts[i]);
+        fn(worker, i);
+    });
+}
+
+std::vector<ImageData> Renderer::render_batch(
+            const std::vector<std::string>& texts,
+            const std::vector<unsigned>& sizes,
+            const std::vector<std::string>& fonts
+        ) {
+    std::vector<ImageData> images(texts.size());
+    for_batch(texts, sizes, fonts, [&](Renderer& worker, const size_t i) {
+        images[i] = worker.render_text(sizes[i]);
+    });
+    return images;
+}
+
+
+void Renderer::render_to(DatasetWriter& writer, const unsigned font_size, const bool with_paths) {
+    Sample sample;
+    sample.image = render_text(font_size);
+    if (with_paths)
+        std::tie(sample.paths, sample.advances) = text_paths();
+    sample.text = shaper.get_text();
+    sample.font = FontStore::shared().path(shaper.get_font_id());
+    sample.mode = mode == RenderMode::FREETYPE ? "freetype" : "myfonts";
+    sample.size = font_size;
+    writer.write(sample);
+}
+
+void Renderer::render_batch_to(
+            DatasetWriter& writer,
+            const std::vector<std::string>& texts,
+            const std::vector<unsigned>& sizes,
+            const std::vector<std::string>& fonts,
+            const bool with_paths
+        ) {
+    for_batch(texts, sizes, fonts, [&](Renderer& worker, const size_t i) {
+        worker.render_to(writer, sizes[i], with_paths);
+    });
+}
@@ -2,15 +2,19 @@
 
 #include "shaper.h"
 #include "freetype.h"
+#include "raster.h"
 #include "myfonts.h"
 #include "path.h"
+#include "dataset.h"
 
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 
 
-using TextPaths = std::pair<std::vector<Path>, std::vector<float>>;
-
-
 enum class RenderMode {
     FREETYPE,
     MYFONTS,
@@ -20,21 +24,76 @@ enum class RenderMode {
 
 class Renderer {
 public:
-    void set_font(const std::string& font_path);
+    void set_font(const std::string& font_path) { return shaper.set_font(FontStore::shared().add(font_path)); };
+    void set_font_id(FontId id) { return shaper.set_font(id); };
+    void set_warm_fonts(size_t capacity) { return shaper.set_warm_fonts(capacity); };
+    // Variation instance of the current font, see Shaper::set_variations. Used by the FreeType
+    // renders, text paths and transformed renders, MyFonts renders its own instance of the font.
+    void set_variations(const std::map<std::string, float>& values) { return shaper.set_variations(values); };
+    std::vector<VariationAxis> variation_axes() const { return shaper.variation_axes(); };
     void set_text(const std::string& text) { return shaper.set_text(text); };
     void set_mode(RenderMode mode, std::optional<std::string> myfonts_id);
     TextPaths text_paths();
     ImageData render_text(unsigned font_size);
+    LabelData render_labels(unsigned font_size);
+    // Same as render_text but written into the leading corner of out, returns the written (C, H, W)
+    ImageDims render_into(unsigned font_size, const ImageView& out);
+    // render_text that doesn't wait for MyFonts: done gets the image or the error exactly once,
+    // possibly on another thread. The renderer is free for the next text as soon as this returns.
+    // The other modes render before returning.
+    void render_text_async(unsigned font_size, RenderDone done);
+    // render_text at every size in one call. The face keeps a size object per size, clusters are
+    // only segmented once and in MyFonts mode the requests of all sizes go out together.
+    std::vector<ImageData> render_text_sizes(const std::vector<unsigned>& font_sizes);
+
+    // The design outlines of the current text scaled to font_size at the current mode's dpi, then
+    // mapped through transform and rasterized. transform works in pixels, y down, with the origin
+    // where the baseline starts.
+    ImageData render_transformed(unsigned font_size, const Matrix3& transform);
+    LabelData render_transformed_labels(unsigned font_size, const Matrix3& transform);
+
+    // Renders sample i as texts[i] at sizes[i] with fonts[i] in the current mode, spread
+    // over the shared thread pool. Every slot owns its own Renderer and so its own FreeType state,
+    // font files are shared through the FontStore. Every sample uses the default instance of its
+    // font, set_variations doesn't carry over to the batch.
+    std::vector<ImageData> render_batch(
+        const std::vector<std::string>& texts,
+        const std::vector<unsigned>& sizes,
+        const std::vector<std::string>& fonts
+    );
+
+    // Renders the current text and queues it on writer, with its outlines when with_paths is set
+    void render_to(DatasetWriter& writer, unsigned font_size, bool with_paths);
+    // render_batch straight into writer, samples are written in completion order
+    void render_batch_to(
+        DatasetWriter& writer,
+        const std::vector<std::string>& texts,
+        const std::vector<unsigned>& sizes,
+        const std::vector<std::string>& fonts,
+        bool with_paths
+    );
 
 
     // Needed for web rendering in Python
     std::vector<std::string> cluster_strings() const { return shaper.cluster_strings(); };
-    void shape_if_needed() { if (shaper.get_clusters().empty()) shaper.shape_design(); };
+    void shape_if_needed() { if (!shaper.is_shaped()) shaper.shape_design(); };
 private:
+    // transform after scaling design units to font_size pixels
+    Matrix3 design_to_pixels(unsigned font_size, const Matrix3& transform) const;
+
+    // Runs fn(worker, i) for every sample on the shared pool, worker set to fonts[i] and texts[i]
+    void for_batch(
+        const std::vector<std::string>& texts,
+        const std::vector<unsigned>& sizes,
+        const std::vector<std::string>& fonts,
+        const std::function<void(Renderer&, size_t)>& fn
+    );
 
     Shaper shaper;
-    std::vector<uint8_t> font_data;
 
     RenderMode mode;
     std::optional<std::string> myfonts_id;
+
+    std::mutex batch_mutex;
+    std::vector<std::unique_ptr<Renderer>> batch_workers;
 };
\ No newline at end of file
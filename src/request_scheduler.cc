@@ -0,0 +1,228 @@
+#include "request_scheduler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <random>
+
+
+namespace {
+
+bool retryable(const cpr::Response& res) {
+    return res.status_code == 0 || res.status_code == 429 || res.status_code >= 500;
+}
+
+uint64_t micros(const std::chrono::steady_clock::duration d) {
+    return static_cast<uint64_t>(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(d).count()));
+}
+
+}
+
+
+void Counter::add(const std::chrono::steady_clock::duration elapsed, const bool error) {
+    const uint64_t us = micros(elapsed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    total_us.fetch_add(us, std::memory_order_relaxed);
+    uint64_t seen = max_us.load(std::memory_order_relaxed);
+    while (us > seen && !max_us.compare_exchange_weak(seen, us, std::memory_order_relaxed)) {
+    }
+    if (error)
+        errors.fetch_add(1, std::memory_order_relaxed);
+}
+
+PartStats Counter::stats() const {
+    const uint64_t n = count.load();
+    return {n, errors.load(), n ? total_us.load() / 1000.0 / n : 0.0, max_us.load() / 1000.0};
+}
+
+void Counter::reset() {
+    count = 0;
+    errors = 0;
+    total_us = 0;
+    max_us = 0;
+}
+
+
+RequestScheduler& RequestScheduler::shared() {
+    static RequestScheduler scheduler;
+    return scheduler;
+}
+
+RequestScheduler::~RequestScheduler() {
+    stop();
+}
+
+// submit doesn't start workers while configuring is set, requests queued meanwhile are picked
+// up by the restart at the end
+void RequestScheduler::configure(const SchedulerConfig& config) {
+    std::lock_guard configure_lock(configure_mutex);
+    std::vector<std::thread> joining;
+    {
+        std::lock_guard lock(mutex);
+        configuring = true;
+        stopping = true;
+        joining.swap(workers);
+    }
+    cv.notify_all();
+    for (auto& worker : joining)
+        worker.join();
+
+    std::lock_guard lock(mutex);
+    settings = config;
+    settings.max_in_flight = std::max(1u, settings.max_in_flight);
+    configuring = false;
+    if (!queue.empty())
+        start();
+}
+
+SchedulerConfig RequestScheduler::config() const {
+    std::lock_guard lock(mutex);
+    return settings;
+}
+
+// Called with the mutex held
+void RequestScheduler::start() {
+    assert(workers.empty());
+    stopping = false;
+    workers.reserve(settings.max_in_flight);
+    for (unsigned i = 0; i < settings.max_in_flight; i++)
+        workers.emplace_back([this] { worker_loop(); });
+}
+
+void RequestScheduler::stop() {
+    std::vector<std::thread> joining;
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+        joining.swap(workers);
+    }
+    cv.notify_all();
+    for (auto& worker : joining)
+        worker.join();
+}
+
+void RequestScheduler::submit(std::string url, std::vector<cpr::Parameter> params, std::function<void(cpr::Response)> done) {
+    auto job = std::make_shared<Job>();
+    job->url = std::move(url);
+    job->params = std::move(params);
+    job->done = std::move(done);
+    job->submitted = Clock::now();
+    {
+        std::lock_guard lock(mutex);
+        if (workers.empty() && !configuring)
+            start();
+        queue.push({job->submitted, job, false});
+        if (settings.hedge_after.count() > 0)
+            queue.push({job->submitted + settings.hedge_after, job, true});
+    }
+    cv.notify_all();
+}
+
+RequestScheduler::Clock::duration RequestScheduler::backoff_delay(const unsigned attempt) const {
+    thread_local std::mt19937 rng{std::random_device{}()};
+    const int64_t base = std::min<int64_t>(settings.max_backoff.count(), settings.backoff.count() << std::min(attempt - 1, 20u));
+    // Jitter in [base / 2, base] so that clients failing together do not retry together
+    std::uniform_int_distribution<int64_t> jitter(base / 2, base);
+    return std::chrono::milliseconds(jitter(rng));
+}
+
+void RequestScheduler::worker_loop() {
+    cpr::Session session;
+    for (;;) {
+        Attempt attempt;
+        std::chrono::milliseconds timeout;
+        {
+            std::unique_lock lock(mutex);
+            for (;;) {
+                if (stopping)
+                    return;
+                if (queue.empty()) {
+                    cv.wait(lock);
+                    continue;
+                }
+                if (queue.top().ready > Clock::now()) {
+                    cv.wait_until(lock, queue.top().ready);
+                    continue;
+                }
+                attempt = queue.top();
+                queue.pop();
+                Job& job = *attempt.job;
+                // Hedges only make sense while the original is still running
+                if (job.finished || (attempt.hedge && job.running == 0))
+                    continue;
+                if (!attempt.hedge)
+                    job.attempts++;
+                job.running++;
+                running++;
+                timeout = settings.timeout;
+                break;
+            }
+        }
+        waits.add(Clock::now() - attempt.ready);
+        run(session, std::move(attempt), timeout);
+    }
+}
+
+void RequestScheduler::run(cpr::Session& session, Attempt attempt, const std::chrono::milliseconds timeout) {
+    Job& job = *attempt.job;
+    cpr::Parameters query;
+    for (const auto& param : job.params)
+        query.Add(param);
+    session.SetUrl(cpr::Url{job.url});
+    session.SetParameters(std::move(query));
+    session.SetTimeout(cpr::Timeout{timeout});
+
+    const auto sent = Clock::now();
+    cpr::Response res = session.Get();
+    const auto finished = Clock::now();
+    const bool ok = res.status_code == 200;
+    http.add(finished - sent, !ok);
+
+    std::unique_lock lock(mutex);
+    job.running--;
+    running--;
+    if (job.finished) {
+        if (attempt.hedge)
+            hedges.add(finished - sent, true);
+        return;
+    }
+    if (attempt.hedge)
+        hedges.add(finished - sent, !ok);
+
+    if (!ok && job.running > 0)
+        return;  // another attempt of this request is still going
+    if (!ok && retryable(res) && job.attempts <= settings.max_retries) {
+        const auto delay = backoff_delay(job.attempts);
+        retries.add(delay);
+        queue.push({finished + delay, attempt.job, false});
+        lock.unlock();
+        cv.notify_one();
+        return;
+    }
+
+    job.finished = true;
+    lock.unlock();
+    if (ok && attempt.hedge)
+        hedge_wins.fetch_add(1, std::memory_order_relaxed);
+    if (!ok && retryable(res))
+        retries.error();
+    requests.add(finished - job.submitted, !ok);
+    job.done(std::move(res));
+}
+
+SchedulerStats RequestScheduler::stats() const {
+    unsigned active;
+    {
+        std::lock_guard lock(mutex);
+        active = running;
+    }
+    return {requests.stats(), waits.stats(), http.stats(), retries.stats(), hedges.stats(), hedge_wins.load(), active};
+}
+
+void RequestScheduler::reset_stats() {
+    requests.reset();
+    waits.reset();
+    http.reset();
+    retries.reset();
+    hedges.reset();
+    hedge_wins = 0;
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cpr/cpr.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+struct SchedulerConfig {
+    // Worker threads, each owning one persistent cpr::Session
+    unsigned max_in_flight = 8;
+    unsigned max_retries = 3;
+    // First retry delay, doubled for every further attempt up to max_backoff
+    std::chrono::milliseconds backoff{100};
+    std::chrono::milliseconds max_backoff{5000};
+    // A duplicate of a request still running after this long is sent too, 0 disables hedging
+    std::chrono::milliseconds hedge_after{0};
+    std::chrono::milliseconds timeout{30000};
+};
+
+
+struct PartStats {
+    uint64_t count;
+    uint64_t errors;
+    double mean_ms;
+    double max_ms;
+};
+
+// requests: submit to result, errors are requests that finally failed
+// queue: ready to picked up by a session
+// http: every attempt, errors are transport failures and non 200 statuses
+// retries: scheduled retries and their backoff, errors are requests out of retries
+// hedges: duplicates sent and their latency, errors are hedges that lost or failed
+struct SchedulerStats {
+    PartStats requests;
+    PartStats queue;
+    PartStats http;
+    PartStats retries;
+    PartStats hedges;
+    uint64_t hedge_wins;
+    unsigned in_flight;
+};
+
+
+class Counter {
+public:
+    void add(std::chrono::steady_clock::duration elapsed, bool error = false);
+    void error() { errors.fetch_add(1, std::memory_order_relaxed); }
+    PartStats stats() const;
+    void reset();
+
+private:
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> total_us{0};
+    std::atomic<uint64_t> max_us{0};
+};
+
+
+// Sends GET requests from a fixed set of sessions, so connections are reused and no more
+// than max_in_flight requests run at once. Transport errors, 429 and 5xx are retried with
+// exponential backoff and jitter, the first successful attempt of a request wins.
+class RequestScheduler {
+public:
+    static RequestScheduler& shared();
+
+    ~RequestScheduler();
+
+    // Waits for running attempts, queued requests are kept
+    void configure(const SchedulerConfig& config);
+    SchedulerConfig config() const;
+
+    // done gets the final response on a scheduler thread, which may still be a failure once
+    // retries ran out. It should hand heavy work elsewhere and return.
+    void submit(std::string url, std::vector<cpr::Parameter> params, std::function<void(cpr::Response)> done);
+
+    SchedulerStats stats() const;
+    void reset_stats();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Job {
+        std::string url;
+        std::vector<cpr::Parameter> params;
+        std::function<void(cpr::Response)> done;
+        Clock::time_point submitted;
+        // Original sends and retries, hedges are counted by the hedges counter and don't use up max_retries
+        unsigned attempts = 0;
+        unsigned running = 0;
+        bool finished = false;
+    };
+
+    struct Attempt {
+        Clock::time_point ready;
+        std::shared_ptr<Job> job;
+        bool hedge;
+
+        bool operator>(const Attempt& other) const { return ready > other.ready; }
+    };
+
+    void start();
+    void stop();
+    void worker_loop();
+    void run(cpr::Session& session, Attempt attempt, std::chrono::milliseconds timeout);
+    Clock::duration backoff_delay(unsigned attempt) const;
+
+    // Serializes configure calls, taken before mutex
+    std::mutex configure_mutex;
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    std::priority_queue<Attempt, std::vector<Attempt>, std::greater<>> queue;
+    std::vector<std::thread> workers;
+    SchedulerConfig settings;
+    bool stopping = false;
+    // Workers are being replaced, submit leaves starting them to configure
+    bool configuring = false;
+    unsigned running = 0;
+
+    Counter requests;
+    Counter waits;
+    Counter http;
+    Counter retries;
+    Counter hedges;
+    std::atomic<uint64_t> hedge_wins{0};
+};
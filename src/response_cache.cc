@@ -0,0 +1,288 @@
+#include "response_cache.h"
+#include "file_util.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <system_error>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+
+namespace {
+
+// Entries start with this tag, the request length and the request itself
+constexpr char MAGIC[8] = {'T', 'R', 'C', 'A', 'C', 'H', 'E', '1'};
+constexpr auto STALE_TEMP = std::chrono::minutes(10);
+// Evict down to this fraction of the budget so that not every put evicts
+constexpr double EVICT_TO = 0.9;
+// Rescan after putting this fraction of the budget, which bounds how far the writers sharing a
+// directory can overshoot before they see each other's entries
+constexpr double RESCAN_AFTER = 0.05;
+
+bool is_temp(const fs::path& p) {
+    return p.extension() == ".tmp";
+}
+
+}
+
+
+ResponseCache& ResponseCache::shared() {
+    static ResponseCache cache;
+    return cache;
+}
+
+void ResponseCache::configure(const std::string& dir, const size_t bytes_budget) {
+    uint64_t scan_generation;
+    {
+        std::lock_guard lock(mutex);
+        directory = dir;
+        budget = bytes_budget;
+        index.clear();
+        index_by_path.clear();
+        bytes = 0;
+        written = 0;
+        scanning = !dir.empty();
+        scan_generation = ++generation;
+    }
+    if (dir.empty())
+        return;
+
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    if (ec) {
+        std::lock_guard lock(mutex);
+        if (generation == scan_generation)
+            scanning = false;
+        throw std::runtime_error(fmt::format("Could not create response cache directory {}: {}", dir, ec.message()));
+    }
+    scan(dir, scan_generation);
+}
+
+void ResponseCache::scan(const fs::path& dir, const uint64_t scan_generation) {
+    uint64_t mark;
+    {
+        std::lock_guard lock(mutex);
+        if (generation != scan_generation)
+            return;
+        mark = uses;
+    }
+
+    // Scanned without the mutex, gets and puts meanwhile keep touching the index. Other
+    // processes evict from the same directory, so every file operation tolerates entries
+    // disappearing underneath it.
+    struct Found {
+        fs::file_time_type time;
+        size_t size;
+        fs::path path;
+    };
+    std::vector<Found> found;
+    std::error_code ec;
+    const auto now = fs::file_time_type::clock::now();
+    for (auto it = fs::recursive_directory_iterator(dir, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        std::error_code entry_ec;
+        if (!it->is_regular_file(entry_ec))
+            continue;
+        const auto time = it->last_write_time(entry_ec);
+        const size_t size = it->file_size(entry_ec);
+        if (entry_ec)
+            continue;
+        if (is_temp(it->path())) {
+            // Left behind by a writer that died mid-write
+            if (now - time > STALE_TEMP)
+                fs::remove(it->path(), entry_ec);
+            continue;
+        }
+        found.push_back({time, size, it->path()});
+    }
+    std::sort(found.begin(), found.end(), [](const Found& a, const Found& b) { return a.time > b.time; });
+
+    std::vector<fs::path> victims;
+    {
+        std::lock_guard lock(mutex);
+        if (generation != scan_generation)
+            return;
+        // Touches move entries to the front, so the ones touched during the scan are a prefix.
+        // They are more recent than every scanned entry, the rest is replaced by the scan.
+        const auto stale = std::find_if(index.begin(), index.end(), [&](const Entry& e) { return e.used <= mark; });
+        for (auto it = stale; it != index.end(); ++it) {
+            bytes -= it->size;
+            index_by_path.erase(it->path.string());
+        }
+        index.erase(stale, index.end());
+        for (Found& f : found) {
+            if (index_by_path.contains(f.path.string()))
+                continue;
+            index.push_back({std::move(f.path), f.size, 0});
+            index_by_path[index.back().path.string()] = std::prev(index.end());
+            bytes += f.size;
+        }
+        written = 0;
+        scanning = false;
+        if (bytes > budget)
+            victims = take_victims();
+    }
+    remove_victims(victims);
+}
+
+void ResponseCache::remove_victims(const std::vector<fs::path>& victims) {
+    std::error_code ec;
+    for (const auto& victim : victims) {
+        if (fs::remove(victim, ec))
+            evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void ResponseCache::touch(const fs::path& path, const size_t size) {
+    if (const auto it = index_by_path.find(path.string()); it != index_by_path.end()) {
+        bytes -= it->second->size;
+        it->second->size = size;
+        it->second->used = ++uses;
+        index.splice(index.begin(), index, it->second);
+    } else {
+        index.push_front({path, size, ++uses});
+        index_by_path[path.string()] = index.begin();
+    }
+    bytes += size;
+}
+
+std::vector<fs::path> ResponseCache::take_victims() {
+    std::vector<fs::path> victims;
+    const auto target = static_cast<size_t>(budget * EVICT_TO);
+    while (bytes > target && !index.empty()) {
+        Entry& last = index.back();
+        bytes -= last.size;
+        index_by_path.erase(last.path.string());
+        victims.push_back(std::move(last.path));
+        index.pop_back();
+    }
+    return victims;
+}
+
+fs::path ResponseCache::entry_path(const std::string& request) const {
+    const std::string name = fmt::format("{:016x}", fnv1a(request));
+    return directory / name.substr(0, 2) / name;
+}
+
+std::optional<std::string> ResponseCache::get(const std::string& request) {
+    fs::path path;
+    uint64_t path_generation;
+    {
+        std::lock_guard lock(mutex);
+        if (directory.empty())
+            return std::nullopt;
+        path = entry_path(request);
+        path_generation = generation;
+    }
+
+    std::ifstream in(path, std::ios::binary);
+    char magic[sizeof(MAGIC)];
+    uint64_t length = 0;
+    if (in.read(magic, sizeof(magic)) && std::equal(magic, magic + sizeof(magic), MAGIC)
+            && in.read(reinterpret_cast<char*>(&length), sizeof(length)) && length == request.size()) {
+        std::string stored(length, '\0');
+        if (in.read(stored.data(), length) && stored == request) {
+            std::string body(std::istreambuf_iterator<char>(in), {});
+            if (!in.bad()) {
+                {
+                    std::lock_guard lock(mutex);
+                    if (generation == path_generation)
+                        touch(path, sizeof(MAGIC) + sizeof(uint64_t) + request.size() + body.size());
+                }
+                // Refresh the on disk LRU position for the next scan, losing the race against an eviction is harmless
+                std::error_code ec;
+                fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+                hits.fetch_add(1, std::memory_order_relaxed);
+                return body;
+            }
+        }
+    }
+    misses.fetch_add(1, std::memory_order_relaxed);
+    return std::nullopt;
+}
+
+void ResponseCache::put(const std::string& request, const std::string& body) {
+    fs::path path;
+    uint64_t path_generation;
+    {
+        std::lock_guard lock(mutex);
+        if (directory.empty())
+            return;
+        path = entry_path(request);
+        path_generation = generation;
+    }
+
+    std::error_code ec;
+    fs::create_directories(path.parent_path(), ec);
+    fs::path temp = path;
+    temp += temp_suffix();
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        const uint64_t length = request.size();
+        out.write(MAGIC, sizeof(MAGIC));
+        out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        out.write(request.data(), request.size());
+        out.write(body.data(), body.size());
+        if (!out.flush()) {
+            out.close();
+            fs::remove(temp, ec);
+            return;
+        }
+    }
+    fs::rename(temp, path, ec);
+    if (ec) {
+        fs::remove(temp, ec);
+        return;
+    }
+
+    const size_t size = sizeof(MAGIC) + sizeof(uint64_t) + request.size() + body.size();
+    std::vector<fs::path> victims;
+    fs::path dir;
+    {
+        std::lock_guard lock(mutex);
+        if (generation != path_generation)
+            return;
+        touch(path, size);
+        written += size;
+        if (!scanning && written > budget * RESCAN_AFTER) {
+            scanning = true;
+            dir = directory;
+        } else if (bytes > budget) {
+            victims = take_victims();
+        }
+    }
+    remove_victims(victims);
+    // The scan evicts once it knows what the other processes wrote
+    if (!dir.empty())
+        scan(dir, path_generation);
+}
+
+void ResponseCache::clear() {
+    std::lock_guard lock(mutex);
+    if (directory.empty())
+        return;
+    std::error_code ec;
+    for (auto it = fs::directory_iterator(directory, ec); !ec && it != fs::directory_iterator(); it.increment(ec)) {
+        std::error_code entry_ec;
+        fs::remove_all(it->path(), entry_ec);
+    }
+    index.clear();
+    index_by_path.clear();
+    bytes = 0;
+    written = 0;
+}
+
+CacheStats ResponseCache::stats() const {
+    std::lock_guard lock(mutex);
+    return {hits.load(), misses.load(), evictions.load(), index.size(), bytes, budget};
+}
+
+void ResponseCache::reset_stats() {
+    hits = 0;
+    misses = 0;
+    evictions = 0;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "lru_cache.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+// On disk cache of HTTP response bodies, addressed by a hash of the full request. Files are
+// written to a temporary name and renamed into place, so any number of processes can share a
+// directory and readers only ever see complete entries. Each entry stores its request, a hash
+// collision reads as a miss. Sizes and recency are kept in an in-memory index, loaded from the
+// directory by configure and updated by every hit and put, and once it grows past the budget the
+// least recently used entries are removed. Every process rescans the directory after it wrote a
+// slice of the budget, so entries other processes added count against the budget too and the
+// directory stays within it plus one slice per writing process. File mtimes are refreshed on
+// hits, so a rescan orders entries by their last use in any process.
+class ResponseCache {
+public:
+    static ResponseCache& shared();
+
+    // An empty directory disables the cache
+    void configure(const std::string& directory, size_t budget);
+
+    std::optional<std::string> get(const std::string& request);
+    void put(const std::string& request, const std::string& body);
+
+    void clear();
+    CacheStats stats() const;
+    void reset_stats();
+
+private:
+    struct Entry {
+        std::filesystem::path path;
+        size_t size;
+        // Value of uses when last touched, 0 for entries only seen by a scan
+        uint64_t used;
+    };
+    using Index = std::list<Entry>;
+
+    std::filesystem::path entry_path(const std::string& request) const;
+    // Called with the mutex held, moves entry to the front or adds it there
+    void touch(const std::filesystem::path& path, size_t size);
+    // Called with the mutex held, unlinks entries down to the eviction target and returns their
+    // paths, which the caller removes once the mutex is released
+    std::vector<std::filesystem::path> take_victims();
+    // Lists dir without the mutex, then replaces every entry not touched since with what it found
+    // and evicts down to the budget. Dropped if configure ran again meanwhile.
+    void scan(const std::filesystem::path& dir, uint64_t scan_generation);
+    void remove_victims(const std::vector<std::filesystem::path>& victims);
+
+    mutable std::mutex mutex;
+    std::filesystem::path directory;
+    size_t budget = 0;
+    // Most recently used first
+    Index index;
+    std::unordered_map<std::string, Index::iterator> index_by_path;
+    size_t bytes = 0;
+    uint64_t uses = 0;
+    // Bytes put since the last scan, and whether one is running
+    size_t written = 0;
+    bool scanning = false;
+    // Bumped by every configure, so that a scan that finished after the next configure is dropped
+    uint64_t generation = 0;
+
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> evictions{0};
+};
@@ -0,0 +1,7 @@
+#include "shape_cache.h"
+
+
+ShapeCache& shape_cache() {
+    static ShapeCache cache(32 << 20);
+    return cache;
+}
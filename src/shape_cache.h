@@ -0,0 +1,76 @@
+#pragma once
+
+#include "lru_cache.h"
+#include "font_store.h"
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <hb.h>
+
+
+struct ShapeKey {
+    FontId font;
+    // Variation instance, 0 for the font's default
+    uint64_t instance;
+    unsigned size;
+    unsigned dpi;
+    bool disable_features;
+    std::string text;
+
+    bool operator==(const ShapeKey&) const = default;
+};
+
+struct ShapeKeyHash {
+    size_t operator()(const ShapeKey& k) const {
+        uint64_t h = std::hash<std::string>{}(k.text);
+        h ^= (static_cast<uint64_t>(k.font) << 32 | k.size) + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2);
+        h ^= k.instance + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2);
+        h ^= (static_cast<uint64_t>(k.dpi) << 1 | k.disable_features) + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2);
+        return static_cast<size_t>(h);
+    }
+};
+
+
+// Glyph ids grouped by cluster in CSR form, clusters in text order. Cluster i starts at byte
+// text_offsets[i] of the text and holds glyphs[starts[i]] .. glyphs[starts[i + 1] - 1].
+struct ClusterLayout {
+    std::vector<unsigned> text_offsets;
+    std::vector<unsigned> starts;
+    std::vector<unsigned> glyphs;
+
+    size_t size() const { return text_offsets.size(); }
+    bool empty() const { return text_offsets.empty(); }
+    std::span<const unsigned> operator[](const size_t i) const {
+        return {glyphs.data() + starts[i], glyphs.data() + starts[i + 1]};
+    }
+
+    void clear() {
+        text_offsets.clear();
+        starts.clear();
+        glyphs.clear();
+    }
+};
+
+
+// Immutable HarfBuzz output for one ShapeKey
+struct ShapedText {
+    std::vector<hb_glyph_info_t> infos;
+    std::vector<hb_glyph_position_t> positions;
+    ClusterLayout clusters;
+
+    size_t bytes() const {
+        return sizeof(ShapedText)
+            + infos.capacity() * sizeof(hb_glyph_info_t)
+            + positions.capacity() * sizeof(hb_glyph_position_t)
+            + (clusters.text_offsets.capacity() + clusters.starts.capacity() + clusters.glyphs.capacity()) * sizeof(unsigned);
+    }
+};
+
+using ShapeCache = LruCache<ShapeKey, ShapedText, ShapeKeyHash>;
+
+// Shared by every Shaper in the process
+ShapeCache& shape_cache();
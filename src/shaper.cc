@@ -1,91 +1,346 @@
 #include "shaper.h"
+#include "outline_atlas.h"
+#include "stats.h"
+#include "lru_cache.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <memory>
 #include <stdexcept>
 #include <hb-ft.h>
 
+
+namespace {
+
+struct CoordsHash {
+    size_t operator()(const std::vector<FT_Fixed>& coords) const {
+        uint64_t h = 14695981039346656037ull;
+        for (const FT_Fixed c : coords)
+            h = (h ^ static_cast<uint64_t>(c)) * 1099511628211ull;
+        return static_cast<size_t>(h);
+    }
+};
+
+// Pixel cbox of the hinted outline, leaves the glyph loaded in the face's slot
+FT_BBox hinted_cbox(const FT_Face face, const unsigned codepoint) {
+    if (FT_Load_Glyph(face, codepoint, FT_LOAD_DEFAULT))
+        throw std::runtime_error("Glyph didn't load, size pass");
+    FT_Glyph glyph;
+    if (FT_Get_Glyph(face->glyph, &glyph))
+        throw std::runtime_error("Glyph didn't get, size pass");
+    FT_BBox cbox;
+    FT_Glyph_Get_CBox(glyph, FT_GLYPH_BBOX_PIXELS, &cbox);
+    FT_Done_Glyph(glyph);
+    return cbox;
+}
+
+// Process wide, so that every Shaper gives the same coordinates the same id in the shared
+// caches. Ids only have to be unique, so the table is bounded: coordinates it dropped get a
+// fresh id next time and miss the caches once.
+uint64_t instance_id(const std::vector<FT_Fixed>& coords) {
+    static LruCache<std::vector<FT_Fixed>, uint64_t, CoordsHash> ids(4096);
+    // 0 is the default instance of every font
+    static std::atomic<uint64_t> next{1};
+    return *ids.get_or_create(coords, [] {
+        return std::make_pair(std::make_shared<const uint64_t>(next.fetch_add(1)), size_t{1});
+    });
+}
+
+}
+
+
 Shaper::Shaper() {
     if (FT_Init_FreeType(&library)) throw std::runtime_error("Freetype library not init");
     buf = hb_buffer_create();
 }
 
 Shaper::~Shaper() {
-    done_font();
+    done_fonts();
     hb_buffer_destroy(buf);
     FT_Done_FreeType(library);
 }
 
-void Shaper::done_font() {
-    if (font) hb_font_destroy(font);
-    if (face) FT_Done_Face(face);
+void Shaper::evict_fonts(const size_t capacity) {
+    while (warm.size() > capacity) {
+        const WarmFont& last = warm.back();
+        hb_font_destroy(last.font);
+        FT_Done_Face(last.face);
+        warm_index.erase(last.id);
+        warm.pop_back();
+    }
+}
+
+void Shaper::done_fonts() {
+    evict_fonts(0);
     font = nullptr;
     face = nullptr;
+    current = nullptr;
 }
 
-void Shaper::set_font(const std::vector<uint8_t>& data) {
-    if (FT_New_Memory_Face(library, data.data(), static_cast<FT_Long>(data.size()), 0, &face)) throw std::runtime_error("Couldn't load FreeType font from data");
-    font = hb_ft_font_create_referenced(face);
-    clusters.clear();
+void Shaper::set_warm_fonts(const size_t capacity) {
+    warm_capacity = std::max<size_t>(capacity, 1);
+    evict_fonts(warm_capacity); // the current font is in front and survives
+}
+
+void Shaper::set_font(const FontId id) {
+    shaped.reset();
+    if (face && font_id == id)
+        return;
+
+    if (const auto it = warm_index.find(id); it != warm_index.end()) {
+        warm.splice(warm.begin(), warm, it->second);
+    } else {
+        const MappedFile& file = FontStore::shared().file(id);
+        FT_Face new_face;
+        if (FT_New_Memory_Face(library, file.data(), static_cast<FT_Long>(file.size()), 0, &new_face))
+            throw std::runtime_error("Couldn't load FreeType font from data");
+        warm.push_front({id, new_face, hb_ft_font_create_referenced(new_face)});
+        warm_index[id] = warm.begin();
+        if (FT_HAS_MULTIPLE_MASTERS(new_face)) {
+            FT_MM_Var* mm;
+            if (FT_Get_MM_Var(new_face, &mm))
+                throw std::runtime_error("Couldn't read variation axes");
+            for (FT_UInt i = 0; i < mm->num_axis; i++) {
+                const FT_Var_Axis& axis = mm->axis[i];
+                warm.front().axes.push_back({axis.tag, axis.minimum, axis.def, axis.maximum});
+            }
+            FT_Done_MM_Var(library, mm);
+        }
+        evict_fonts(warm_capacity);
+    }
+
+    current = &warm.front();
+    face = current->face;
+    font = current->font;
+    font_id = id;
+    face_size = 0;
+    if (current->instance != 0) {
+        std::vector<FT_Fixed> defaults;
+        for (const FaceAxis& axis : current->axes)
+            defaults.push_back(axis.def);
+        set_instance(*current, defaults, 0);
+    }
+    instance = 0;
+}
+
+
+std::vector<VariationAxis> Shaper::variation_axes() const {
+    std::vector<VariationAxis> axes;
+    if (!current)
+        return axes;
+    for (const FaceAxis& axis : current->axes) {
+        char tag[4];
+        hb_tag_to_string(static_cast<hb_tag_t>(axis.tag), tag);
+        std::string name(tag, 4);
+        name.erase(name.find_last_not_of(' ') + 1);
+        axes.push_back({name, axis.min / 65536.0f, axis.def / 65536.0f, axis.max / 65536.0f});
+    }
+    return axes;
+}
+
+void Shaper::set_variations(const std::map<std::string, float>& values) {
+    if (!current)
+        throw std::runtime_error("No font set");
+    const std::vector<FaceAxis>& axes = current->axes;
+    std::vector<FT_Fixed> coords;
+    for (const FaceAxis& axis : axes)
+        coords.push_back(axis.def);
+    for (const auto& [tag, value] : values) {
+        const auto t = static_cast<FT_ULong>(hb_tag_from_string(tag.c_str(), static_cast<int>(tag.size())));
+        const auto it = std::find_if(axes.begin(), axes.end(), [&](const FaceAxis& axis) { return axis.tag == t; });
+        if (it == axes.end())
+            throw std::invalid_argument("Font has no variation axis " + tag);
+        const auto fixed = static_cast<FT_Fixed>(std::lround(static_cast<double>(value) * 65536.0));
+        coords[it - axes.begin()] = std::clamp(fixed, it->min, it->max);
+    }
+
+    // Instances are told apart in the caches by an id interned for their exact coordinates
+    const bool is_default = std::equal(coords.begin(), coords.end(), axes.begin(), [](const FT_Fixed c, const FaceAxis& axis) {
+        return c == axis.def;
+    });
+    const uint64_t id = is_default ? 0 : instance_id(coords);
+    if (id == current->instance)
+        return;
+    set_instance(*current, coords, id);
+    instance = id;
+    shaped.reset();
+    face_size = 0;
+}
+
+void Shaper::set_instance(WarmFont& warm_font, const std::vector<FT_Fixed>& coords, const uint64_t id) {
+    std::vector<FT_Fixed> design = coords;
+    if (FT_Set_Var_Design_Coordinates(warm_font.face, static_cast<FT_UInt>(design.size()), design.data()))
+        throw std::runtime_error("Couldn't set variation coordinates");
+    std::vector<hb_variation_t> variations;
+    for (size_t i = 0; i < coords.size(); i++)
+        variations.push_back({static_cast<hb_tag_t>(warm_font.axes[i].tag), coords[i] / 65536.0f});
+    hb_font_set_variations(warm_font.font, variations.data(), static_cast<unsigned>(variations.size()));
+    warm_font.instance = id;
 }
 
 void Shaper::set_text(const std::string& text) {
     this->text = text;
-    clusters.clear();
+    shaped.reset();
 }
 
 void Shaper::set_params(const Params& params) {
     this->params = params;
-    clusters.clear(); // disable_features in Params can change shaping
+    shaped.reset(); // disable_features in Params can change shaping
+}
+
+void Shaper::size_face() const {
+    if (face_size == char_size && face_dpi == char_dpi)
+        return;
+    std::vector<FaceSize>& sizes = current->sizes;
+    const auto it = std::find_if(sizes.begin(), sizes.end(), [&](const FaceSize& s) {
+        return s.size == char_size && s.dpi == char_dpi;
+    });
+    if (it != sizes.end()) {
+        std::rotate(sizes.begin(), it, it + 1);
+        FT_Activate_Size(sizes.front().handle);
+    } else {
+        // The active size is always in front, so the one dropped here isn't in use
+        if (sizes.size() >= max_face_sizes) {
+            FT_Done_Size(sizes.back().handle);
+            sizes.pop_back();
+        }
+        FT_Size handle;
+        if (FT_New_Size(face, &handle))
+            throw std::runtime_error("Couldn't create FreeType size");
+        FT_Activate_Size(handle);
+        FT_Set_Char_Size(face, 0, char_size * 64, 0, char_dpi);
+        sizes.insert(sizes.begin(), {char_size, char_dpi, handle});
+    }
+    hb_ft_font_changed(font);
+    face_size = char_size;
+    face_dpi = char_dpi;
 }
 
 void Shaper::shape_internal() {
+    ShapeKey key{font_id, instance, char_size, char_dpi, params.disable_features, text};
+    if (auto hit = shape_cache().get(key)) {
+        shaped = std::move(hit);
+        return;
+    }
+
+    size_face();
     hb_buffer_reset(buf);
     hb_buffer_add_utf8(buf, text.c_str(), -1, 0, -1);
     hb_buffer_guess_segment_properties(buf);
     hb_shape(font, buf, nullptr, 0);
     // TODO: handle features
-    glyph_info = hb_buffer_get_glyph_infos(buf, &glyph_count);
-    glyph_pos = hb_buffer_get_glyph_positions(buf, &glyph_count);
-
-    
-    if (clusters.empty()) {
-        std::map<unsigned, std::vector<unsigned>> cluster_map;
-        for (int i = 0; i < glyph_count; i++) {
-            const unsigned cluster = glyph_info[i].cluster;
-            cluster_map[cluster].emplace_back(i);
+    unsigned glyph_count;
+    const hb_glyph_info_t* glyph_info = hb_buffer_get_glyph_infos(buf, &glyph_count);
+    const hb_glyph_position_t* glyph_pos = hb_buffer_get_glyph_positions(buf, &glyph_count);
+
+    // Anything still shaped is the same font, text and features at another size. Sizes only move
+    // glyphs, so the same glyphs in the same clusters keep their segmentation.
+    std::shared_ptr<const ShapedText> previous = std::move(shaped);
+    const ShapedText* segmented = previous && previous->infos.size() == glyph_count
+            && std::equal(glyph_info, glyph_info + glyph_count, previous->infos.begin(), [](const hb_glyph_info_t& a, const hb_glyph_info_t& b) {
+                return a.codepoint == b.codepoint && a.cluster == b.cluster;
+            }) ? previous.get() : nullptr;
+    // Dropped before the scratch check, so that the scratch can be reused once the cache let go
+    // of it. Whichever of the old results segmented points to is kept alive until the copy.
+    if (previous == scratch)
+        previous.reset();
+    std::shared_ptr<ShapedText> old_scratch;
+    if (!scratch || scratch.use_count() > 1) {
+        old_scratch = std::move(scratch);
+        scratch = std::make_shared<ShapedText>();
+    }
+    ShapedText& result = *scratch;
+    result.infos.assign(glyph_info, glyph_info + glyph_count);
+    result.positions.assign(glyph_pos, glyph_pos + glyph_count);
+
+    if (segmented) {
+        if (segmented != &result)
+            result.clusters = segmented->clusters;
+        shaped = shape_cache().put(std::move(key), scratch, result.bytes());
+        return;
+    }
+
+    // HarfBuzz keeps clusters monotonic, ascending for LTR and descending for RTL. Glyphs of a
+    // cluster stay in buffer order and clusters go in text order.
+    bool ascending = true;
+    bool descending = true;
+    for (unsigned i = 1; i < glyph_count; i++) {
+        ascending &= glyph_info[i - 1].cluster <= glyph_info[i].cluster;
+        descending &= glyph_info[i - 1].cluster >= glyph_info[i].cluster;
+    }
+    order.resize(glyph_count);
+    for (unsigned i = 0; i < glyph_count; i++)
+        order[i] = i;
+    if (!ascending && descending) {
+        for (unsigned run_end = glyph_count; run_end > 0;) {
+            unsigned run_start = run_end - 1;
+            while (run_start > 0 && glyph_info[run_start - 1].cluster == glyph_info[run_end - 1].cluster)
+                run_start--;
+            std::reverse(order.begin() + run_start, order.begin() + run_end);
+            run_end = run_start;
         }
-        clusters.assign(cluster_map.begin(), cluster_map.end());
+        std::reverse(order.begin(), order.end());
+    } else if (!ascending) {
+        std::stable_sort(order.begin(), order.end(), [&](const unsigned a, const unsigned b) {
+            return glyph_info[a].cluster < glyph_info[b].cluster;
+        });
     }
+
+    ClusterLayout& clusters = result.clusters;
+    clusters.clear();
+    clusters.glyphs.assign(order.begin(), order.end());
+    for (unsigned i = 0; i < glyph_count; i++) {
+        if (i == 0 || glyph_info[order[i]].cluster != glyph_info[order[i - 1]].cluster) {
+            clusters.text_offsets.push_back(glyph_info[order[i]].cluster);
+            clusters.starts.push_back(i);
+        }
+    }
+    clusters.starts.push_back(glyph_count);
+
+    shaped = shape_cache().put(std::move(key), scratch, result.bytes());
 }
 
 
 void Shaper::shape_design() {
-    FT_Set_Char_Size(face, 0, face->units_per_EM * 64, 0, 0);
-    hb_ft_font_changed(font);
+    char_size = face->units_per_EM;
+    char_dpi = 72;
     shape_internal();
 }
 
 void Shaper::shape(const unsigned font_size) {
-    FT_Set_Char_Size(face, 0, font_size * 64, 0, params.dpi);
-    hb_ft_font_changed(font);
+    const StageTimer timer(Stage::SHAPE);
+    char_size = font_size;
+    char_dpi = params.dpi;
     shape_internal();
 }
 
 
 void Shaper::path_data(std::vector<Path>& paths, std::vector<float>& advances) {
+    const auto& clusters = get_clusters();
+    const hb_glyph_info_t* glyph_info = get_glyph_info();
+    const hb_glyph_position_t* glyph_pos = get_glyph_pos();
+    // Atlases hold the design size outlines of the default instance, anything else still goes through FreeType
+    const bool design = char_size == static_cast<unsigned>(face->units_per_EM) && char_dpi == 72 && instance == 0;
+    const std::shared_ptr<const OutlineAtlas> atlas = design ? OutlineStore::shared().find(font_id) : nullptr;
+    if (!atlas)
+        size_face();
     for (unsigned i = 0; i < clusters.size(); i++) {
-        const auto& [_, cluster] = clusters[i];
         Path path;
         float x = 0;
-        for (const unsigned glyph_id : cluster ) {
-            if (FT_Load_Glyph(face, glyph_info[glyph_id].codepoint, FT_LOAD_NO_HINTING | FT_LOAD_NO_BITMAP))
-                throw std::runtime_error("Glyph didn't load, design pass");
-            FT_Outline& outline = face->glyph->outline;
-
+        for (const unsigned glyph_id : clusters[i]) {
             const auto& pos = glyph_pos[glyph_id];
             const auto x_offset = static_cast<float>(pos.x_offset);
             const auto offset_x = x + x_offset;
             const auto offset_y = static_cast<float>(pos.y_offset);
-            path.add(outline, {offset_x, offset_y});
+            if (atlas) {
+                path.add(atlas->glyph(glyph_info[glyph_id].codepoint), {offset_x, offset_y});
+            } else {
+                if (FT_Load_Glyph(face, glyph_info[glyph_id].codepoint, FT_LOAD_NO_HINTING | FT_LOAD_NO_BITMAP))
+                    throw std::runtime_error("Glyph didn't load, design pass");
+                path.add(face->glyph->outline, {offset_x, offset_y});
+            }
             const auto x_advance = static_cast<float>(pos.x_advance);
             x += x_advance;
         }
@@ -97,10 +352,11 @@ void Shaper::path_data(std::vector<Path>& paths, std::vector<float>& advances) {
 
 
 std::vector<std::string> Shaper::cluster_strings() const {
+    const auto& clusters = get_clusters();
     std::vector<std::string> cluster_strs;
     for (unsigned i = 0; i < clusters.size(); i++) {
-        const unsigned start = clusters[i].first;
-        const unsigned end = i < clusters.size() - 1 ? clusters[i + 1].first : text.size();
+        const unsigned start = clusters.text_offsets[i];
+        const unsigned end = i < clusters.size() - 1 ? clusters.text_offsets[i + 1] : text.size();
         const unsigned len = end - start;
         cluster_strs.emplace_back(text.substr(start, len));
     }
@@ -109,11 +365,13 @@ std::vector<std::string> Shaper::cluster_strings() const {
 
 
 std::vector<ClusterWindow> Shaper::get_cluster_windows() const {
+    const auto& clusters = get_clusters();
+    const hb_glyph_position_t* glyph_pos = get_glyph_pos();
     std::vector<ClusterWindow> windows;
     int advance = 0;
-    for (const auto& [_, cluster] : clusters) {
+    for (unsigned i = 0; i < clusters.size(); i++) {
         int cluster_advance = 0;
-        for (const unsigned glyph_id : cluster) {
+        for (const unsigned glyph_id : clusters[i]) {
             const auto& pos = glyph_pos[glyph_id];
             cluster_advance += pos.x_advance;
         }
@@ -125,19 +383,66 @@ std::vector<ClusterWindow> Shaper::get_cluster_windows() const {
     return windows;
 }
 
+std::shared_ptr<const CachedGlyph> Shaper::load_glyph(const unsigned glyph_id) const {
+    const unsigned codepoint = get_glyph_info()[glyph_id].codepoint;
+    return glyph_cache().get_or_create({font_id, instance, codepoint, char_size, char_dpi, false}, [&] {
+        auto cached = std::make_shared<CachedGlyph>();
+        size_face();
+
+        // Same as FT_LOAD_RENDER, but grab the outline cbox on the way
+        cached->cbox = hinted_cbox(face, codepoint);
+        if (FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL))
+            throw std::runtime_error("Glyph didn't load, render pass");
+        const FT_GlyphSlot slot = face->glyph;
+        const FT_Bitmap& bitmap = slot->bitmap;
+        cached->bitmap_left = slot->bitmap_left;
+        cached->bitmap_top = slot->bitmap_top;
+        cached->rows = bitmap.rows;
+        cached->width = bitmap.width;
+        cached->bitmap.resize(static_cast<size_t>(bitmap.rows) * bitmap.width);
+        for (unsigned row = 0; row < bitmap.rows; row++)
+            std::copy_n(bitmap.buffer + row * bitmap.pitch, bitmap.width, cached->bitmap.data() + row * bitmap.width);
+
+        cached->ink_x0 = cached->ink_y0 = std::numeric_limits<int>::max();
+        cached->ink_x1 = cached->ink_y1 = std::numeric_limits<int>::min();
+        for (unsigned row = 0; row < bitmap.rows; row++) {
+            for (unsigned col = 0; col < bitmap.width; col++) {
+                if (cached->bitmap[row * bitmap.width + col] == 0)
+                    continue;
+                cached->ink_x0 = std::min<int>(cached->ink_x0, col);
+                cached->ink_x1 = std::max<int>(cached->ink_x1, col + 1);
+                cached->ink_y0 = std::min<int>(cached->ink_y0, row);
+                cached->ink_y1 = std::max<int>(cached->ink_y1, row + 1);
+            }
+        }
+
+        const size_t cost = sizeof(CachedGlyph) + cached->bitmap.size();
+        return std::pair{std::shared_ptr<const CachedGlyph>(std::move(cached)), cost};
+    });
+}
+
+std::shared_ptr<const CachedGlyph> Shaper::load_glyph_metrics(const unsigned glyph_id) const {
+    const unsigned codepoint = get_glyph_info()[glyph_id].codepoint;
+    return glyph_cache().get_or_create({font_id, instance, codepoint, char_size, char_dpi, true}, [&] {
+        auto cached = std::make_shared<CachedGlyph>();
+        size_face();
+        cached->cbox = hinted_cbox(face, codepoint);
+        return std::pair{std::shared_ptr<const CachedGlyph>(std::move(cached)), sizeof(CachedGlyph)};
+    });
+}
+
 TextBox Shaper::text_size(unsigned* max_cluster_width) const {
+    const auto& clusters = get_clusters();
+    const hb_glyph_position_t* glyph_pos = get_glyph_pos();
     TextBox box{};
 
-    FT_Glyph glyph;
-    FT_BBox bbox;
-
     int x = 0;
     unsigned max_width = 0;
-    for (const auto& [_, cluster] : clusters) {
+    for (unsigned i = 0; i < clusters.size(); i++) {
         int cluster_x_min = std::numeric_limits<int>::max();
         int cluster_x_max = std::numeric_limits<int>::min();
 
-        for (const unsigned glyph_id : cluster) {
+        for (const unsigned glyph_id : clusters[i]) {
             const auto& pos = glyph_pos[glyph_id];
             const int px = pixel(x + pos.x_offset);
             const int py = pixel(pos.y_offset);
@@ -145,12 +450,8 @@ TextBox Shaper::text_size(unsigned* max_cluster_width) const {
             const int advanced = pixel(x);
             if (advanced > box.x_max)
                 box.x_max = advanced;
-  
-            if (FT_Load_Glyph(face, glyph_info[glyph_id].codepoint, FT_LOAD_DEFAULT))
-                throw std::runtime_error("Glyph didn't load, size pass");
-            if (FT_Get_Glyph(face->glyph, &glyph))
-                throw std::runtime_error("Glyph didn't get, size pass");
-            FT_Glyph_Get_CBox(glyph, FT_GLYPH_BBOX_PIXELS, &bbox);
+
+            FT_BBox bbox = load_glyph_metrics(glyph_id)->cbox;
 
             bbox.xMax += px;
             bbox.xMin += px;
@@ -172,7 +473,6 @@ TextBox Shaper::text_size(unsigned* max_cluster_width) const {
                 box.y_max = static_cast<int>(bbox.yMax);
             if (bbox.yMin < box.y_min)
                 box.y_min = static_cast<int>(bbox.yMin);
-            FT_Done_Glyph(glyph);
         }
 
         if (max_cluster_width) {
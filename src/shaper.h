@@ -1,10 +1,16 @@
 #pragma once
 
 #include "path.h"
+#include "glyph_cache.h"
+#include "font_store.h"
+#include "shape_cache.h"
 
 #include "common.h"
 
+#include <list>
 #include <map>
+#include <memory>
+#include <unordered_map>
 #include <string>
 #include <vector>
 
@@ -12,6 +18,8 @@
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include FT_GLYPH_H
+#include FT_SIZES_H
+#include FT_MULTIPLE_MASTERS_H
 
 struct ClusterWindow {
     int x;
@@ -19,6 +27,15 @@ struct ClusterWindow {
 };
 
 
+// A variation axis in design units, tag as in "wght"
+struct VariationAxis {
+    std::string tag;
+    float min;
+    float def;
+    float max;
+};
+
+
 struct Params {
     unsigned dpi;
     bool disable_features;
@@ -29,18 +46,31 @@ public:
     Shaper();
     ~Shaper();
 
-    const hb_glyph_info_t* get_glyph_info() const { return glyph_info; }
-    const hb_glyph_position_t* get_glyph_pos() const { return glyph_pos; }
-    unsigned get_glyph_count() const { return glyph_count; }
-    const std::vector<std::pair<unsigned, std::vector<unsigned>>>& get_clusters() const { return clusters; }
+    const hb_glyph_info_t* get_glyph_info() const { return shaped ? shaped->infos.data() : nullptr; }
+    const hb_glyph_position_t* get_glyph_pos() const { return shaped ? shaped->positions.data() : nullptr; }
+    unsigned get_glyph_count() const { return shaped ? static_cast<unsigned>(shaped->infos.size()) : 0; }
+    const ClusterLayout& get_clusters() const { return shaped ? shaped->clusters : no_clusters; }
+    bool is_shaped() const { return shaped != nullptr; }
     FT_Face get_ft_face() const { return face; }
+    FontId get_font_id() const { return font_id; }
+    uint64_t get_instance() const { return instance; }
     const std::string& get_text() const { return text; }
+    const Params& get_params() const { return params; }
 
 
-    void set_font(const std::vector<uint8_t>& data);
+    // Switches to a FontStore font, O(1) while its face is still warm
+    void set_font(FontId id);
     void set_text(const std::string& text);
     void set_params(const Params& params);
-    void done_font();
+    void set_warm_fonts(size_t capacity);
+    void done_fonts();
+
+    // Axes of the current font, empty unless it is variable
+    std::vector<VariationAxis> variation_axes() const;
+    // Moves the current face to the instance at values by axis tag, axes left out take their
+    // default and values are clamped to the axis range. The face and HarfBuzz font stay, and
+    // shaping and glyphs are cached per instance. set_font to another font starts at its default.
+    void set_variations(const std::map<std::string, float>& values);
 
 
     void shape_design();
@@ -50,22 +80,69 @@ public:
 
     std::vector<std::string> cluster_strings() const;
     std::vector<ClusterWindow> get_cluster_windows() const;
+    // Ink box from the hinted outline cboxes, no glyph is rasterized
     TextBox text_size(unsigned* max_cluster_width = nullptr) const;
+
+    // Hinted bitmap and pixel cbox of shaped glyph glyph_id at the last shaped size, cached across calls
+    std::shared_ptr<const CachedGlyph> load_glyph(unsigned glyph_id) const;
 private:
+    // load_glyph without rendering, only the cbox is set
+    std::shared_ptr<const CachedGlyph> load_glyph_metrics(unsigned glyph_id) const;
     void shape_internal();
+    void size_face() const;
 
 
     FT_Library library = nullptr;
+    struct FaceAxis {
+        FT_ULong tag;
+        FT_Fixed min;
+        FT_Fixed def;
+        FT_Fixed max;
+    };
+    // A size object of a face, FT_Activate_Size switches to it without redoing the size setup
+    struct FaceSize {
+        unsigned size;
+        unsigned dpi;
+        FT_Size handle;
+    };
+    struct WarmFont {
+        FontId id;
+        FT_Face face;
+        hb_font_t* font;
+        // Most recently used first, freed with the face
+        std::vector<FaceSize> sizes;
+        std::vector<FaceAxis> axes;
+        uint64_t instance = 0;
+    };
+    void set_instance(WarmFont& warm_font, const std::vector<FT_Fixed>& coords, uint64_t id);
+    void evict_fonts(size_t capacity);
+
+    // Faces created from the shared mappings, most recently used first
+    std::list<WarmFont> warm;
+    std::unordered_map<FontId, std::list<WarmFont>::iterator> warm_index;
+    size_t warm_capacity = 32;
+
     FT_Face face = nullptr;
+    WarmFont* current = nullptr;
+    static constexpr size_t max_face_sizes = 8;
+    FontId font_id = 0;
+    // Interned id of the current design coordinates, 0 at the default instance
+    uint64_t instance = 0;
+    unsigned char_size = 0;
+    unsigned char_dpi = 0;
+    // Size face is actually set to, FreeType is only touched once the caches miss
+    mutable unsigned face_size = 0;
+    mutable unsigned face_dpi = 0;
 
     hb_buffer_t* buf;
     hb_font_t* font = nullptr;
-    unsigned glyph_count = 0;
-    hb_glyph_info_t* glyph_info = nullptr;
-    hb_glyph_position_t* glyph_pos = nullptr;
 
     std::string text;
-    std::vector<std::pair<unsigned, std::vector<unsigned>>> clusters;
+    std::shared_ptr<const ShapedText> shaped;
+    // Reused for the next miss once nothing else references it
+    std::shared_ptr<ShapedText> scratch;
+    std::vector<unsigned> order;
+    static inline const ClusterLayout no_clusters;
 
     Params params;
 };
\ No newline at end of file
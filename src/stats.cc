@@ -0,0 +1,231 @@
+#include "stats.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+
+namespace {
+
+// Spans a thread keeps before further ones are dropped, about 24 MiB
+constexpr size_t MAX_SPANS = size_t{1} << 20;
+
+struct Slot {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> total_ns;
+    std::atomic<uint64_t> max_ns;
+    std::array<std::atomic<uint64_t>, HISTOGRAM_BUCKETS> buckets;
+};
+
+struct Span {
+    int64_t start_ns;
+    int64_t duration_ns;
+    Stage stage;
+};
+
+// Written by its own thread only, read and reset by anyone
+struct Shard {
+    unsigned tid;
+    std::array<Slot, STAGE_COUNT> stages;
+    std::array<std::atomic<uint64_t>, TALLY_COUNT> tallies;
+
+    std::mutex span_mutex;
+    std::vector<Span> spans;
+    uint64_t dropped = 0;
+};
+
+std::mutex registry_mutex;
+// Shards outlive their threads, so stats of finished threads still count
+std::vector<std::shared_ptr<Shard>> shards;
+std::atomic<int64_t> trace_epoch_ns{0};
+
+Shard& local_shard() {
+    thread_local const std::shared_ptr<Shard> shard = [] {
+        auto s = std::make_shared<Shard>();
+        std::lock_guard lock(registry_mutex);
+        s->tid = static_cast<unsigned>(shards.size());
+        shards.push_back(s);
+        return s;
+    }();
+    return *shard;
+}
+
+std::vector<std::shared_ptr<Shard>> all_shards() {
+    std::lock_guard lock(registry_mutex);
+    return shards;
+}
+
+int64_t since_epoch_ns(const Stats::Clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+
+size_t bucket(const uint64_t ns) {
+    return std::min<size_t>(std::bit_width(ns / 1000), HISTOGRAM_BUCKETS - 1);
+}
+
+double quantile_ms(const StageStats& s, const double q) {
+    if (s.count == 0)
+        return 0;
+    const auto rank = static_cast<uint64_t>(std::ceil(q * static_cast<double>(s.count)));
+    uint64_t seen = 0;
+    for (size_t b = 0; b < HISTOGRAM_BUCKETS - 1; ++b) {
+        seen += s.histogram[b];
+        if (seen >= rank)
+            return std::min(static_cast<double>(uint64_t{1} << b) / 1000, s.max_ms);
+    }
+    return s.max_ms;
+}
+
+}
+
+
+void Stats::enable(const bool enabled) {
+    on.store(enabled, std::memory_order_relaxed);
+    if (!enabled)
+        trace_on.store(false, std::memory_order_relaxed);
+}
+
+void Stats::enable_trace(const bool enabled) {
+    if (enabled) {
+        trace_epoch_ns.store(since_epoch_ns(Clock::now()), std::memory_order_relaxed);
+        on.store(true, std::memory_order_relaxed);
+    }
+    trace_on.store(enabled, std::memory_order_relaxed);
+}
+
+
+void Stats::record(const Stage stage, const Clock::time_point start, const Clock::time_point end) {
+    Shard& shard = local_shard();
+    Slot& slot = shard.stages[static_cast<size_t>(stage)];
+    const auto ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    slot.count.fetch_add(1, std::memory_order_relaxed);
+    slot.total_ns.fetch_add(ns, std::memory_order_relaxed);
+    if (ns > slot.max_ns.load(std::memory_order_relaxed))
+        slot.max_ns.store(ns, std::memory_order_relaxed);
+    slot.buckets[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+
+    if (tracing()) {
+        std::lock_guard lock(shard.span_mutex);
+        if (shard.spans.size() < MAX_SPANS)
+            shard.spans.push_back({since_epoch_ns(start), static_cast<int64_t>(ns), stage});
+        else
+            shard.dropped++;
+    }
+}
+
+void Stats::add_enabled(const Tally tally, const uint64_t n) {
+    local_shard().tallies[static_cast<size_t>(tally)].fetch_add(n, std::memory_order_relaxed);
+}
+
+
+RenderStats Stats::snapshot() {
+    RenderStats out{};
+    std::array<uint64_t, STAGE_COUNT> total_ns{};
+    std::array<uint64_t, STAGE_COUNT> max_ns{};
+    for (const auto& shard : all_shards()) {
+        for (size_t i = 0; i < STAGE_COUNT; ++i) {
+            const Slot& slot = shard->stages[i];
+            StageStats& s = out.stages[i];
+            s.count += slot.count.load(std::memory_order_relaxed);
+            total_ns[i] += slot.total_ns.load(std::memory_order_relaxed);
+            max_ns[i] = std::max(max_ns[i], slot.max_ns.load(std::memory_order_relaxed));
+            for (size_t b = 0; b < HISTOGRAM_BUCKETS; ++b)
+                s.histogram[b] += slot.buckets[b].load(std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < TALLY_COUNT; ++i)
+            out.tallies[i] += shard->tallies[i].load(std::memory_order_relaxed);
+    }
+
+    for (size_t i = 0; i < STAGE_COUNT; ++i) {
+        StageStats& s = out.stages[i];
+        s.total_ms = static_cast<double>(total_ns[i]) / 1e6;
+        s.mean_ms = s.count ? s.total_ms / static_cast<double>(s.count) : 0;
+        s.max_ms = static_cast<double>(max_ns[i]) / 1e6;
+        s.p50_ms = quantile_ms(s, 0.5);
+        s.p90_ms = quantile_ms(s, 0.9);
+        s.p99_ms = quantile_ms(s, 0.99);
+    }
+    return out;
+}
+
+void Stats::reset() {
+    for (const auto& shard : all_shards()) {
+        for (Slot& slot : shard->stages) {
+            slot.count.store(0, std::memory_order_relaxed);
+            slot.total_ns.store(0, std::memory_order_relaxed);
+            slot.max_ns.store(0, std::memory_order_relaxed);
+            for (auto& b : slot.buckets)
+                b.store(0, std::memory_order_relaxed);
+        }
+        for (auto& tally : shard->tallies)
+            tally.store(0, std::memory_order_relaxed);
+
+        std::lock_guard lock(shard->span_mutex);
+        shard->spans.clear();
+        shard->dropped = 0;
+    }
+    trace_epoch_ns.store(since_epoch_ns(Clock::now()), std::memory_order_relaxed);
+}
+
+
+void Stats::write_trace(const std::string& path) {
+    const int64_t epoch = trace_epoch_ns.load(std::memory_order_relaxed);
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    uint64_t dropped = 0;
+    bool first = true;
+    for (const auto& shard : all_shards()) {
+        std::lock_guard lock(shard->span_mutex);
+        dropped += shard->dropped;
+        if (shard->spans.empty())
+            continue;
+        fmt::format_to(std::back_inserter(out), "{}{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":\"thread {}\"}}}}",
+            first ? "" : ",\n", shard->tid, shard->tid);
+        first = false;
+        for (const Span& span : shard->spans) {
+            fmt::format_to(std::back_inserter(out), ",\n{{\"name\":\"{}\",\"cat\":\"renderer\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}}}",
+                name(span.stage), shard->tid, static_cast<double>(span.start_ns - epoch) / 1000, static_cast<double>(span.duration_ns) / 1000);
+        }
+    }
+    fmt::format_to(std::back_inserter(out), "\n],\"otherData\":{{\"dropped_spans\":{}}}}}\n", dropped);
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.write(out.data(), static_cast<std::streamsize>(out.size())))
+        throw std::runtime_error("Could not write trace to " + path);
+}
+
+
+const char* Stats::name(const Stage stage) {
+    switch (stage) {
+        case Stage::RENDER: return "render";
+        case Stage::SHAPE: return "shape";
+        case Stage::GLYPH_LOAD: return "glyph_load";
+        case Stage::COMPOSITE: return "composite";
+        case Stage::RASTER: return "raster";
+        case Stage::HTTP: return "http";
+        case Stage::DECODE: return "decode";
+        case Stage::TEMPLATE: return "template";
+        case Stage::MATCH: return "match";
+        case Stage::MARK: return "mark";
+        default: return "unknown";
+    }
+}
+
+const char* Stats::name(const Tally tally) {
+    switch (tally) {
+        case Tally::RENDERS: return "renders";
+        case Tally::GLYPHS: return "glyphs";
+        case Tally::CLUSTERS: return "clusters";
+        case Tally::REQUESTS: return "requests";
+        case Tally::RESPONSE_CACHE_HITS: return "response_cache_hits";
+        case Tally::RESPONSE_BYTES: return "response_bytes";
+        default: return "unknown";
+    }
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+// Timed stages of a render. Every stage keeps a count, total and max time and a latency histogram.
+enum class Stage : uint8_t {
+    RENDER,         // Renderer::render_text, render_labels, render_into and render_text_sizes as a whole, render_text_async until sent
+    SHAPE,
+    GLYPH_LOAD,     // Freetype: glyph bitmaps and the ink box
+    COMPOSITE,      // Freetype: blending the glyphs into the canvas
+    RASTER,         // Rasterizer: flattening, filling and blending transformed paths
+    HTTP,           // MyFonts: request submitted to response, response cache hits are not timed
+    DECODE,         // MyFonts: PNG decode of a response
+    TEMPLATE,       // MyFonts: cutting a cluster out of its pair images
+    MATCH,          // MyFonts: finding a cluster in the full image
+    MARK,           // MyFonts: writing a cluster into its mask
+    COUNT
+};
+
+enum class Tally : uint8_t {
+    RENDERS,
+    GLYPHS,
+    CLUSTERS,
+    REQUESTS,
+    RESPONSE_CACHE_HITS,
+    RESPONSE_BYTES,
+    COUNT
+};
+
+inline constexpr size_t STAGE_COUNT = static_cast<size_t>(Stage::COUNT);
+inline constexpr size_t TALLY_COUNT = static_cast<size_t>(Tally::COUNT);
+
+// Bucket 0 holds times under 1 us, bucket b times in [2^(b-1), 2^b) us, the last one everything longer
+inline constexpr size_t HISTOGRAM_BUCKETS = 24;
+
+
+struct StageStats {
+    uint64_t count;
+    double total_ms;
+    double mean_ms;
+    double max_ms;
+    // Upper bounds of the histogram buckets the quantiles fall into
+    double p50_ms;
+    double p90_ms;
+    double p99_ms;
+    std::array<uint64_t, HISTOGRAM_BUCKETS> histogram;
+};
+
+struct RenderStats {
+    std::array<StageStats, STAGE_COUNT> stages;
+    std::array<uint64_t, TALLY_COUNT> tallies;
+};
+
+
+// Process wide instrumentation. Every thread records into its own slots, which are only summed
+// up by snapshot, so timers on different threads never share a cache line. Off by default,
+// while off a timer is a single relaxed load.
+class Stats {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static bool enabled() { return on.load(std::memory_order_relaxed); }
+    static bool tracing() { return trace_on.load(std::memory_order_relaxed); }
+
+    static void enable(bool enabled);
+    // Keeps a span of every timed stage for write_trace, implies enable
+    static void enable_trace(bool enabled);
+
+    static void record(Stage stage, Clock::time_point start, Clock::time_point end);
+    static void add(Tally tally, uint64_t n = 1) {
+        if (enabled())
+            add_enabled(tally, n);
+    }
+
+    static RenderStats snapshot();
+    // Zeroes every thread's stats and drops the kept spans
+    static void reset();
+
+    // Chrome trace event JSON (chrome://tracing, Perfetto) of the spans kept since tracing was
+    // enabled or last reset, one track per thread
+    static void write_trace(const std::string& path);
+
+    static const char* name(Stage stage);
+    static const char* name(Tally tally);
+
+private:
+    static void add_enabled(Tally tally, uint64_t n);
+
+    static inline std::atomic<bool> on{false};
+    static inline std::atomic<bool> trace_on{false};
+};
+
+
+class StageTimer {
+public:
+    explicit StageTimer(const Stage stage) : stage(stage) {
+        if (Stats::enabled())
+            start = Stats::Clock::now();
+    }
+
+    ~StageTimer() {
+        if (start != Stats::Clock::time_point{})
+            Stats::record(stage, start, Stats::Clock::now());
+    }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+    Stage stage;
+    Stats::Clock::time_point start{};
+};
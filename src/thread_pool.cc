@@ -0,0 +1,159 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+
+namespace {
+
+// Set on pool threads, so that their submits stay local
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local unsigned current_queue = 0;
+
+}
+
+
+ThreadPool::ThreadPool(const unsigned threads) {
+    queues.reserve(std::max(1u, threads));
+    for (unsigned i = 0; i < std::max(1u, threads); i++)
+        queues.emplace_back(std::make_unique<Queue>());
+    workers.reserve(threads);
+    for (unsigned i = 0; i < threads; i++)
+        workers.emplace_back([this, i] { worker_loop(i); });
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(sleep_mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+ThreadPool& ThreadPool::shared() {
+    // At least one worker even on a single core, the MyFonts pipelines only run from pool tasks
+    static ThreadPool pool(std::max(2u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    const unsigned index = current_pool == this
+        ? current_queue
+        : next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+    {
+        std::lock_guard lock(queues[index]->mutex);
+        queues[index]->tasks.emplace_back(std::move(task));
+    }
+    {
+        std::lock_guard lock(sleep_mutex);
+        pending.fetch_add(1);
+    }
+    cv.notify_one();
+}
+
+bool ThreadPool::pop(const unsigned index, std::function<void()>& task) {
+    const auto n = static_cast<unsigned>(queues.size());
+    {
+        Queue& own = *queues[index % n];
+        std::lock_guard lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            pending.fetch_sub(1);
+            return true;
+        }
+    }
+    for (unsigned k = 1; k < n; k++) {
+        Queue& victim = *queues[(index + k) % n];
+        std::lock_guard lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            pending.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::worker_loop(const unsigned index) {
+    current_pool = this;
+    current_queue = index;
+    for (;;) {
+        std::function<void()> task;
+        if (pop(index, task)) {
+            task();
+            continue;
+        }
+        std::unique_lock lock(sleep_mutex);
+        cv.wait(lock, [this] { return stopping || pending.load() > 0; });
+        if (stopping && pending.load() == 0)
+            return;
+    }
+}
+
+
+namespace {
+
+struct ForState {
+    size_t count;
+    const std::function<void(unsigned, size_t)>* fn;
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> done{0};
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    void run(const unsigned slot) {
+        for (;;) {
+            const size_t i = next.fetch_add(1);
+            if (i >= count)
+                return;
+            if (!failed.load(std::memory_order_relaxed)) {
+                try {
+                    (*fn)(slot, i);
+                } catch (...) {
+                    std::lock_guard lock(mutex);
+                    if (!error)
+                        error = std::current_exception();
+                    failed = true;
+                }
+            }
+            if (done.fetch_add(1) + 1 == count) {
+                std::lock_guard lock(mutex);
+                cv.notify_all();
+            }
+        }
+    }
+};
+
+}
+
+
+void ThreadPool::parallel_for(const size_t count, unsigned max_slots, const std::function<void(unsigned, size_t)>& fn) {
+    if (count == 0)
+        return;
+    if (max_slots == 0)
+        max_slots = size() + 1;
+
+    // Late helpers may still touch the counters after we return, the shared state outlives us
+    auto state = std::make_shared<ForState>();
+    state->count = count;
+    state->fn = &fn;
+
+    const size_t helpers = std::min<size_t>({size(), max_slots - 1, count - 1});
+    for (unsigned slot = 1; slot <= helpers; slot++)
+        submit([state, slot] { state->run(slot); });
+
+    state->run(0);
+
+    std::unique_lock lock(state->mutex);
+    state->cv.wait(lock, [&] { return state->done.load() == count; });
+    if (state->error)
+        std::rethrow_exception(state->error);
+}
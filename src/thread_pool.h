@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Work stealing pool. Every worker owns a deque: tasks submitted from a worker go to its own
+// deque and run newest first, tasks from other threads are dealt round robin. An idle worker
+// takes the oldest task of another deque before it goes to sleep.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Process wide pool with one thread per core besides the caller, and at least one
+    static ThreadPool& shared();
+
+    unsigned size() const { return static_cast<unsigned>(workers.size()); }
+
+    void submit(std::function<void()> task);
+
+    // Runs fn(slot, i) for every i in [0, count). The calling thread works as slot 0, so a
+    // call made from inside a pool task still finishes when every worker is busy.
+    // Slots are < max_slots (0 means size() + 1) and never run concurrently with themselves.
+    void parallel_for(size_t count, unsigned max_slots, const std::function<void(unsigned, size_t)>& fn);
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void worker_loop(unsigned index);
+    // Own deque from the back, then the others from the front starting after index
+    bool pop(unsigned index, std::function<void()>& task);
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::atomic<size_t> pending{0};
+    std::atomic<unsigned> next_queue{0};
+    std::mutex sleep_mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+};
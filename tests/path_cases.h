@@ -0,0 +1,108 @@
+#pragma once
+
+#include "path.h"
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+// Paths run through Path::reorder by the golden test. Coordinates are multiples of 1/4 so
+// that they print the same everywhere, random cases only use mt19937 output, which the
+// standard fixes, and never a distribution.
+namespace path_cases {
+
+inline Point at(const int x, const int y) {
+    return {static_cast<float>(x) / 4.0f, static_cast<float>(y) / 4.0f};
+}
+
+inline Command move(const int x, const int y) { return Command(CommandType::MOVE, at(x, y)); }
+inline Command line(const int x, const int y) { return Command(CommandType::LINE, at(x, y)); }
+inline Command quad(const int cx, const int cy, const int x, const int y) {
+    return Command(CommandType::QUAD, at(x, y), at(cx, cy));
+}
+inline Command cubic(const int c0x, const int c0y, const int c1x, const int c1y, const int x, const int y) {
+    return Command(CommandType::CUBIC, at(x, y), at(c0x, c0y), at(c1x, c1y));
+}
+inline Command close() { return Command(CommandType::CLOSE); }
+
+
+// A contour of n random lines and cubics, or quads when with_quads, optionally closed
+inline void random_contour(std::mt19937& rng, std::vector<Command>& out, const unsigned n, const bool with_quads, const bool closed) {
+    const auto coord = [&] { return static_cast<int>(rng() % 801) - 400; };
+    out.push_back(move(coord(), coord()));
+    for (unsigned i = 0; i < n; ++i) {
+        switch (rng() % 3) {
+            case 0:
+                out.push_back(line(coord(), coord()));
+                break;
+            case 1:
+                if (with_quads) {
+                    out.push_back(quad(coord(), coord(), coord(), coord()));
+                    break;
+                }
+                [[fallthrough]];
+            default:
+                out.push_back(cubic(coord(), coord(), coord(), coord(), coord(), coord()));
+                break;
+        }
+    }
+    if (closed)
+        out.push_back(close());
+}
+
+
+inline std::vector<std::pair<std::string, std::vector<Command>>> all() {
+    std::vector<std::pair<std::string, std::vector<Command>>> cases;
+
+    cases.push_back({"empty", {}});
+    cases.push_back({"single_point", {move(4, 8)}});
+    cases.push_back({"single_point_closed", {move(4, 8), close()}});
+    cases.push_back({"two_single_points", {move(40, 8), move(4, 8)}});
+    cases.push_back({"clockwise_square", {move(0, 0), line(40, 0), line(40, 40), line(0, 40), line(0, 0)}});
+    cases.push_back({"counter_clockwise_square", {move(0, 0), line(0, 40), line(40, 40), line(40, 0), line(0, 0)}});
+    cases.push_back({"rotated_start", {move(40, 40), line(0, 40), line(0, 0), line(40, 0), line(40, 40)}});
+    cases.push_back({"flip_rotated_start", {move(40, 40), line(40, 0), line(0, 0), line(0, 40), line(40, 40)}});
+    cases.push_back({"closed_square", {move(0, 0), line(40, 0), line(40, 40), line(0, 40), close()}});
+    cases.push_back({"closed_square_rotated", {move(40, 40), line(0, 40), line(0, 0), line(40, 0), close()}});
+    cases.push_back({"flip_cubic", {move(0, 0), cubic(0, 20, 20, 40, 40, 40), line(40, 0), line(0, 0)}});
+    cases.push_back({"keep_cubic", {move(0, 0), line(40, 0), cubic(20, 40, 0, 20, 0, 0)}});
+    cases.push_back({"flip_quad", {move(0, 0), quad(0, 40, 40, 40), line(0, 0)}});
+    cases.push_back({"keep_quad", {move(0, 0), line(40, 0), quad(40, 40, 0, 0)}});
+    cases.push_back({"open_triangle", {move(0, 0), line(40, 0), line(20, 40)}});
+    cases.push_back({"contours_sorted", {
+        move(100, 100), line(140, 100), line(140, 140), line(100, 140), line(100, 100),
+        move(0, 0), line(40, 0), line(40, 40), line(0, 40), line(0, 0),
+        move(0, 60), line(40, 60), line(40, 80), line(0, 60),
+    }});
+    cases.push_back({"flip_all_contours", {
+        move(0, 0), line(0, 40), line(40, 40), line(40, 0), line(0, 0),
+        move(60, 0), line(100, 0), line(100, 40), line(60, 0),
+    }});
+    cases.push_back({"mixed_open_closed", {
+        move(0, 0), line(40, 0), line(40, 40), close(),
+        move(60, 0), line(100, 0), line(80, 40),
+        move(8, 200),
+    }});
+    cases.push_back({"tie_on_y", {
+        move(-40, 0), line(-40, 40), line(-80, 0), line(-40, 0),
+        move(40, 0), line(80, 0), line(40, 40), line(40, 0),
+    }});
+
+    std::mt19937 rng(20261017);
+    for (int i = 0; i < 200; ++i) {
+        std::vector<Command> commands;
+        const unsigned contours = 1 + rng() % 4;
+        const bool with_quads = i % 5 == 0;
+        for (unsigned c = 0; c < contours; ++c) {
+            const unsigned n = rng() % 7;
+            random_contour(rng, commands, n, with_quads, rng() % 4 == 0);
+        }
+        cases.push_back({"random_" + std::to_string(i), std::move(commands)});
+    }
+    return cases;
+}
+
+}
@@ -0,0 +1,76 @@
+#include "path_cases.h"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+
+namespace {
+
+// name -> Path::string() after reorder, or "error: " and the message. Written by the
+// out of place reorder from before contours were reordered in place, regenerate only when
+// the output is meant to change.
+std::map<std::string, std::string> load_golden(const std::string& path) {
+    std::ifstream in(path);
+    if (!in)
+        throw std::runtime_error("Couldn't open " + path);
+    std::map<std::string, std::string> golden;
+    std::string line;
+    while (std::getline(in, line)) {
+        const size_t tab = line.find('\t');
+        if (tab != std::string::npos)
+            golden.emplace(line.substr(0, tab), line.substr(tab + 1));
+    }
+    return golden;
+}
+
+}
+
+
+TEST(PathReorder, MatchesGolden) {
+    const auto golden = load_golden(RENDERER_TEST_DATA "/path_reorder.golden");
+    const auto cases = path_cases::all();
+    ASSERT_EQ(golden.size(), cases.size());
+
+    for (const auto& [name, commands] : cases) {
+        SCOPED_TRACE(name);
+        const auto expected = golden.find(name);
+        ASSERT_NE(expected, golden.end());
+
+        Path path(commands);
+        const std::string before = path.string();
+        std::string got;
+        try {
+            path.reorder();
+            got = path.string();
+        } catch (const std::exception& e) {
+            got = std::string("error: ") + e.what();
+            // Errors are raised before the first write
+            EXPECT_EQ(path.string(), before);
+        }
+        EXPECT_EQ(got, expected->second);
+    }
+}
+
+TEST(PathReorder, ReorderPathsMatchesReorder) {
+    std::vector<Path> paths;
+    std::vector<std::string> expected;
+    for (const auto& [name, commands] : path_cases::all()) {
+        Path path(commands);
+        try {
+            path.reorder();
+        } catch (const std::exception&) {
+            continue;
+        }
+        paths.emplace_back(commands);
+        expected.push_back(path.string());
+    }
+
+    reorder_paths(paths);
+    ASSERT_EQ(paths.size(), expected.size());
+    for (size_t i = 0; i < paths.size(); ++i)
+        EXPECT_EQ(paths[i].string(), expected[i]);
+}
@@ -0,0 +1,112 @@
+#include "response_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <random>
+#include <string>
+
+namespace fs = std::filesystem;
+
+
+namespace {
+
+// Fresh directory under the system temp directory, removed again with the fixture
+class ResponseCacheTest : public testing::Test {
+protected:
+    void SetUp() override {
+        dir = fs::temp_directory_path() / ("renderer_response_cache_" + std::to_string(std::random_device{}()));
+        fs::remove_all(dir);
+    }
+
+    void TearDown() override {
+        std::error_code ec;
+        fs::remove_all(dir, ec);
+    }
+
+    size_t directory_bytes() const {
+        size_t total = 0;
+        for (const auto& entry : fs::recursive_directory_iterator(dir)) {
+            if (entry.is_regular_file())
+                total += entry.file_size();
+        }
+        return total;
+    }
+
+    fs::path dir;
+};
+
+std::string request(const int i) {
+    return "https://example.com/render?text=" + std::to_string(i);
+}
+
+}
+
+
+TEST_F(ResponseCacheTest, GetReturnsWhatWasPut) {
+    ResponseCache cache;
+    cache.configure(dir.string(), 1 << 20);
+    cache.put(request(1), "first");
+    cache.put(request(2), std::string(1000, 'x'));
+
+    EXPECT_EQ(cache.get(request(1)), "first");
+    EXPECT_EQ(cache.get(request(2)), std::string(1000, 'x'));
+    EXPECT_EQ(cache.get(request(3)), std::nullopt);
+
+    const CacheStats stats = cache.stats();
+    EXPECT_EQ(stats.hits, 2u);
+    EXPECT_EQ(stats.misses, 1u);
+    EXPECT_EQ(stats.entries, 2u);
+}
+
+TEST_F(ResponseCacheTest, DisabledWithoutDirectory) {
+    ResponseCache cache;
+    cache.put(request(1), "body");
+    EXPECT_EQ(cache.get(request(1)), std::nullopt);
+}
+
+TEST_F(ResponseCacheTest, ConfigureLoadsExistingEntries) {
+    {
+        ResponseCache writer;
+        writer.configure(dir.string(), 1 << 20);
+        writer.put(request(1), "kept");
+    }
+    ResponseCache reader;
+    reader.configure(dir.string(), 1 << 20);
+    EXPECT_EQ(reader.stats().entries, 1u);
+    EXPECT_EQ(reader.get(request(1)), "kept");
+}
+
+TEST_F(ResponseCacheTest, EvictsLeastRecentlyUsed) {
+    const std::string body(1000, 'x');
+    ResponseCache cache;
+    cache.configure(dir.string(), 20000);
+    cache.put(request(0), body);
+    for (int i = 1; i < 100; i++) {
+        cache.put(request(i), body);
+        // Keeps the first entry the most recently used one
+        ASSERT_TRUE(cache.get(request(0)));
+    }
+
+    EXPECT_GT(cache.stats().evictions, 0u);
+    EXPECT_LE(directory_bytes(), 20000u);
+    EXPECT_EQ(cache.get(request(1)), std::nullopt);
+    EXPECT_EQ(cache.get(request(99)), body);
+}
+
+// Two caches on one directory stand in for two processes, each only sees its own puts
+// between scans
+TEST_F(ResponseCacheTest, BudgetHoldsAcrossWriters) {
+    const std::string body(1000, 'x');
+    const size_t budget = 50000;
+    ResponseCache a, b;
+    a.configure(dir.string(), budget);
+    b.configure(dir.string(), budget);
+    for (int i = 0; i < 500; i++) {
+        a.put(request(2 * i), body);
+        b.put(request(2 * i + 1), body);
+    }
+
+    // Each writer can be up to one rescan slice ahead of what the other has seen
+    EXPECT_LE(directory_bytes(), budget + 2 * budget / 20 + 2 * (body.size() + 100));
+}
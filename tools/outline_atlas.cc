@@ -0,0 +1,120 @@
+// Builds the outline atlases Shaper::path_data reads design outlines from: every glyph of a
+// font is decomposed once, on all cores, into DIR/<font file name>.outlines.
+
+#include "outline_atlas.h"
+
+#include <fmt/format.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+namespace {
+
+constexpr const char* USAGE = R"(usage: outline_atlas --out DIR [--fonts FILE] [--force] [FONT...]
+
+  --out DIR     atlases are written to DIR/<font file name>.outlines
+  --fonts FILE  one font path per line, # starts a comment
+  --force       rebuild atlases that are already up to date
+)";
+
+
+struct Options {
+    std::string out;
+    std::vector<std::string> fonts;
+    bool force = false;
+};
+
+
+std::vector<std::string> read_fonts(const std::string& path) {
+    std::ifstream in(path);
+    if (!in)
+        throw std::runtime_error(fmt::format("Could not open font list {}", path));
+    std::vector<std::string> fonts;
+    std::string line;
+    while (std::getline(in, line)) {
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        line.erase(0, line.find_first_not_of(" \t"));
+        if (!line.empty() && line[0] != '#')
+            fonts.push_back(line);
+    }
+    return fonts;
+}
+
+Options parse_args(const int argc, char** argv) {
+    Options o;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const auto value = [&]() -> std::string {
+            if (i + 1 >= argc)
+                throw std::invalid_argument(fmt::format("{} needs a value", arg));
+            return argv[++i];
+        };
+        if (arg == "--out") o.out = value();
+        else if (arg == "--fonts") {
+            const std::vector<std::string> listed = read_fonts(value());
+            o.fonts.insert(o.fonts.end(), listed.begin(), listed.end());
+        }
+        else if (arg == "--force") o.force = true;
+        else if (arg.starts_with("--")) throw std::invalid_argument(fmt::format("Unknown argument {}", arg));
+        else o.fonts.push_back(arg);
+    }
+    if (o.out.empty())
+        throw std::invalid_argument("--out is required");
+    if (o.fonts.empty())
+        throw std::invalid_argument("No fonts given");
+    return o;
+}
+
+
+bool up_to_date(const std::string& path, const FontId font) {
+    try {
+        return OutlineAtlas(path).matches(FontStore::shared().file(font));
+    } catch (const std::runtime_error&) {
+        return false;
+    }
+}
+
+int run(const Options& o) {
+    std::filesystem::create_directories(o.out);
+    size_t built = 0;
+    for (const std::string& font_path : o.fonts) {
+        const FontId font = FontStore::shared().add(font_path);
+        const std::string path = atlas_path(o.out, font_path);
+        if (!o.force && up_to_date(path, font)) {
+            fmt::print("{}: up to date\n", path);
+            continue;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        OutlineAtlas::build(font, path);
+        const OutlineAtlas atlas(path);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        fmt::print("{}: {} glyphs, {} bytes, {:.2f} s\n", path, atlas.glyph_count(), std::filesystem::file_size(path), seconds);
+        built++;
+    }
+    fmt::print("{} of {} atlases built\n", built, o.fonts.size());
+    return 0;
+}
+
+}
+
+
+int main(int argc, char** argv) {
+    Options options;
+    try {
+        options = parse_args(argc, argv);
+    } catch (const std::exception& e) {
+        fmt::print(stderr, "outline_atlas: {}\n\n{}", e.what(), USAGE);
+        return 2;
+    }
+    try {
+        return run(options);
+    } catch (const std::exception& e) {
+        fmt::print(stderr, "outline_atlas: {}\n", e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,260 @@
+// Dataset generation without Python: samples words from a corpus, fonts from a list and sizes
+// from a distribution, renders them on all cores and streams them into a DatasetWriter.
+
+#include "outline_atlas.h"
+#include "render.h"
+#include "response_cache.h"
+#include "stats.h"
+
+#include <fmt/format.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+namespace {
+
+constexpr const char* USAGE = R"(usage: textgen --corpus FILE --fonts FILE --out PREFIX [options]
+
+  --corpus FILE         text file, every whitespace separated word is a candidate sample
+  --fonts FILE          one font path per line, # starts a comment
+  --out PREFIX          shards are written to PREFIX-00000.tdat, PREFIX-00001.tdat, ...
+  --sizes SPEC          comma separated sizes, ranges and weights, e.g. 16,24:2,32-64 (default 12-64)
+  --count N             number of samples (default 10000)
+  --seed N              sample i depends only on the seed and i (default 0)
+  --mode MODE           freetype or myfonts (default freetype)
+  --myfonts-id ID       font id for --mode myfonts
+  --response-cache DIR  on disk cache for myfonts responses
+  --outline-atlas DIR   take outlines from the fonts' atlases in DIR, building missing ones
+  --shard-bytes N       shard size in bytes (default 1073741824)
+  --batch N             samples handed to the pool at once (default 1024)
+  --no-paths            leave the outlines out of the records
+  --stats               print per stage timings at the end
+  --trace FILE          write a Chrome trace of every stage to FILE
+)";
+
+
+struct SizeRange {
+    unsigned low;
+    unsigned high;
+    double weight;
+};
+
+struct Options {
+    std::string corpus;
+    std::string fonts;
+    std::string out;
+    std::string sizes = "12-64";
+    uint64_t count = 10000;
+    uint64_t seed = 0;
+    std::string mode = "freetype";
+    std::optional<std::string> myfonts_id;
+    std::string response_cache;
+    std::string outline_atlas;
+    size_t shard_bytes = size_t{1} << 30;
+    size_t batch = 1024;
+    bool paths = true;
+    bool stats = false;
+    std::string trace;
+};
+
+
+Options parse_args(const int argc, char** argv) {
+    Options o;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const auto value = [&]() -> std::string {
+            if (i + 1 >= argc)
+                throw std::invalid_argument(fmt::format("{} needs a value", arg));
+            return argv[++i];
+        };
+        if (arg == "--corpus") o.corpus = value();
+        else if (arg == "--fonts") o.fonts = value();
+        else if (arg == "--out") o.out = value();
+        else if (arg == "--sizes") o.sizes = value();
+        else if (arg == "--count") o.count = std::stoull(value());
+        else if (arg == "--seed") o.seed = std::stoull(value());
+        else if (arg == "--mode") o.mode = value();
+        else if (arg == "--myfonts-id") o.myfonts_id = value();
+        else if (arg == "--response-cache") o.response_cache = value();
+        else if (arg == "--outline-atlas") o.outline_atlas = value();
+        else if (arg == "--shard-bytes") o.shard_bytes = std::stoull(value());
+        else if (arg == "--batch") o.batch = std::max<size_t>(1, std::stoull(value()));
+        else if (arg == "--no-paths") o.paths = false;
+        else if (arg == "--stats") o.stats = true;
+        else if (arg == "--trace") o.trace = value();
+        else throw std::invalid_argument(fmt::format("Unknown argument {}", arg));
+    }
+    if (o.corpus.empty() || o.fonts.empty() || o.out.empty())
+        throw std::invalid_argument("--corpus, --fonts and --out are required");
+    if (o.mode != "freetype" && o.mode != "myfonts")
+        throw std::invalid_argument(fmt::format("Unknown mode {}", o.mode));
+    if ((o.mode == "myfonts") != o.myfonts_id.has_value())
+        throw std::invalid_argument("--myfonts-id goes with --mode myfonts");
+    return o;
+}
+
+// "16,24:2,32-64" is 16, 24 with twice the weight, or anything in [32, 64]
+std::vector<SizeRange> parse_sizes(const std::string& spec) {
+    std::vector<SizeRange> sizes;
+    std::stringstream entries(spec);
+    std::string entry;
+    while (std::getline(entries, entry, ',')) {
+        double weight = 1.0;
+        if (const size_t colon = entry.find(':'); colon != std::string::npos) {
+            weight = std::stod(entry.substr(colon + 1));
+            entry.resize(colon);
+        }
+        unsigned low, high;
+        if (const size_t dash = entry.find('-'); dash != std::string::npos) {
+            low = std::stoul(entry.substr(0, dash));
+            high = std::stoul(entry.substr(dash + 1));
+        } else {
+            low = high = std::stoul(entry);
+        }
+        if (low == 0 || high < low || weight <= 0)
+            throw std::invalid_argument(fmt::format("Bad size entry \"{}\"", entry));
+        sizes.push_back({low, high, weight});
+    }
+    if (sizes.empty())
+        throw std::invalid_argument("--sizes is empty");
+    return sizes;
+}
+
+std::vector<std::string> read_words(const std::string& path) {
+    std::ifstream in(path);
+    if (!in)
+        throw std::runtime_error(fmt::format("Could not open corpus {}", path));
+    std::vector<std::string> words;
+    std::string word;
+    while (in >> word)
+        words.push_back(std::move(word));
+    if (words.empty())
+        throw std::runtime_error(fmt::format("Corpus {} has no words", path));
+    return words;
+}
+
+std::vector<std::string> read_fonts(const std::string& path) {
+    std::ifstream in(path);
+    if (!in)
+        throw std::runtime_error(fmt::format("Could not open font list {}", path));
+    std::vector<std::string> fonts;
+    std::string line;
+    while (std::getline(in, line)) {
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        line.erase(0, line.find_first_not_of(" \t"));
+        if (!line.empty() && line[0] != '#')
+            fonts.push_back(line);
+    }
+    if (fonts.empty())
+        throw std::runtime_error(fmt::format("Font list {} is empty", path));
+    return fonts;
+}
+
+uint64_t splitmix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+
+void print_stats(const RenderStats& s) {
+    fmt::print("\n{:<12} {:>10} {:>12} {:>10} {:>10} {:>10} {:>10}\n", "stage", "count", "total ms", "mean ms", "p50 ms", "p99 ms", "max ms");
+    for (size_t i = 0; i < STAGE_COUNT; ++i) {
+        const StageStats& st = s.stages[i];
+        if (st.count == 0)
+            continue;
+        fmt::print("{:<12} {:>10} {:>12.1f} {:>10.3f} {:>10.3f} {:>10.3f} {:>10.3f}\n",
+            Stats::name(static_cast<Stage>(i)), st.count, st.total_ms, st.mean_ms, st.p50_ms, st.p99_ms, st.max_ms);
+    }
+    for (size_t i = 0; i < TALLY_COUNT; ++i) {
+        if (s.tallies[i])
+            fmt::print("{:<20} {:>10}\n", Stats::name(static_cast<Tally>(i)), s.tallies[i]);
+    }
+}
+
+
+int run(const Options& o) {
+    const std::vector<std::string> words = read_words(o.corpus);
+    const std::vector<std::string> fonts = read_fonts(o.fonts);
+    const std::vector<SizeRange> sizes = parse_sizes(o.sizes);
+    std::vector<double> weights;
+    for (const auto& s : sizes)
+        weights.push_back(s.weight);
+
+    if (!o.response_cache.empty())
+        ResponseCache::shared().configure(o.response_cache, size_t{16} << 30);
+    if (!o.outline_atlas.empty()) {
+        for (const std::string& font : fonts)
+            OutlineStore::shared().attach_dir(FontStore::shared().add(font), o.outline_atlas);
+    }
+
+    Stats::enable(o.stats);
+    Stats::enable_trace(!o.trace.empty());
+
+    Renderer renderer;
+    renderer.set_mode(o.mode == "myfonts" ? RenderMode::MYFONTS : RenderMode::FREETYPE, o.myfonts_id);
+    DatasetWriter writer(o.out, o.shard_bytes);
+
+    std::vector<std::string> texts;
+    std::vector<unsigned> text_sizes;
+    std::vector<std::string> text_fonts;
+    const auto start = std::chrono::steady_clock::now();
+    for (uint64_t first = 0; first < o.count; first += o.batch) {
+        const uint64_t last = std::min<uint64_t>(o.count, first + o.batch);
+        texts.clear();
+        text_sizes.clear();
+        text_fonts.clear();
+        for (uint64_t i = first; i < last; i++) {
+            std::mt19937_64 rng(splitmix64(o.seed ^ splitmix64(i)));
+            std::discrete_distribution<size_t> pick_size(weights.begin(), weights.end());
+            const SizeRange& range = sizes[pick_size(rng)];
+            texts.push_back(words[std::uniform_int_distribution<size_t>(0, words.size() - 1)(rng)]);
+            text_fonts.push_back(fonts[std::uniform_int_distribution<size_t>(0, fonts.size() - 1)(rng)]);
+            text_sizes.push_back(std::uniform_int_distribution<unsigned>(range.low, range.high)(rng));
+        }
+        renderer.render_batch_to(writer, texts, text_sizes, text_fonts, o.paths);
+
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        fmt::print(stderr, "\r{}/{} samples, {:.1f} samples/s", last, o.count, last / seconds);
+    }
+    writer.close();
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    fmt::print(stderr, "\n");
+    fmt::print("{} samples in {} shards, {:.2f} s, {:.1f} samples/s\n", writer.records(), writer.shards(), seconds, writer.records() / seconds);
+
+    if (o.stats)
+        print_stats(Stats::snapshot());
+    if (!o.trace.empty())
+        Stats::write_trace(o.trace);
+    return 0;
+}
+
+}
+
+
+int main(int argc, char** argv) {
+    Options options;
+    try {
+        options = parse_args(argc, argv);
+    } catch (const std::exception& e) {
+        fmt::print(stderr, "textgen: {}\n\n{}", e.what(), USAGE);
+        return 2;
+    }
+    try {
+        return run(options);
+    } catch (const std::exception& e) {
+        fmt::print(stderr, "\ntextgen: {}\n", e.what());
+        return 1;
+    }
+}